@@ -2,9 +2,19 @@ class FilterWrapper {
     static module = null; // Shared module for all instances
     static modulePromise = null; // Promise for module initialization
 
-    constructor(N, modelAntennaDelay = false) {
+    // background runs the updates on a worker thread (AsyncFilter): update() then returns at once and the
+    // estimate getters report the last completed update; the particle views are not available in that mode.
+    // The worker only exists in the multi-threaded build (`make mt`, src/filter-mt.js), which needs a
+    // cross-origin isolated page. With the default src/filter.js the updates still run inside update(),
+    // so background does not unblock the render loop there.
+    // get() and serialize() of a background filter wait for the running update; N and getStats() do not.
+    constructor(N, modelAntennaDelay = false, seed = undefined, background = false) {
         this.filterInstance = null; // Instance-specific Filter object
         this.modelAntennaDelay = modelAntennaDelay;
+        this.background = background;
+        if (background && !globalThis.crossOriginIsolated) {
+            console.warn('FilterWrapper: the page is not cross-origin isolated, background updates run inline');
+        }
         // Ensure the shared module is loaded
         if (!FilterWrapper.modulePromise) {
             FilterWrapper.modulePromise = FilterModule().then((mod) => {
@@ -15,7 +25,11 @@ class FilterWrapper {
 
         // Wait for the module to load and then create the Filter instance
         FilterWrapper.modulePromise.then(() => {
-            this.filterInstance = new FilterWrapper.module.Filter(N, modelAntennaDelay);
+            // each filter owns its random stream, pass a seed to make a run reproducible
+            const FilterClass = background ? FilterWrapper.module.AsyncFilter : FilterWrapper.module.Filter;
+            this.filterInstance = seed === undefined
+                ? new FilterClass(N, modelAntennaDelay)
+                : new FilterClass(N, modelAntennaDelay, seed);
             console.log(`Filter instance initialized with ${N} elements.`);
         });
     }
@@ -51,6 +65,20 @@ class FilterWrapper {
         this.filterInstance.set(index, particle);
     }
 
+    // Zero-copy Float32Array views of the x/y/z/d arrays in the WASM heap.
+    // The views alias the filter storage: fetch them again after every update.
+    getParticleView() {
+        this.sanityCheck();
+        return this.filterInstance.getParticleView();
+    }
+
+    // Interleaved xyz of every stride-th particle, can be copied into a
+    // THREE.BufferAttribute(view.positions, view.itemSize) in one call
+    getPositionView(stride = 1) {
+        this.sanityCheck();
+        return this.filterInstance.getPositionView(stride);
+    }
+
     get N() {
         this.sanityCheck();
         return this.filterInstance.getN();
@@ -61,8 +89,82 @@ class FilterWrapper {
         this.filterInstance.setN(n);
     }
 
+    // KLD-adaptive particle count between minN and maxN; N then reports the current size
+    setAdaptive(enabled, minN, maxN, binSize = 0.5, epsilon = 0.05) {
+        this.sanityCheck();
+        this.filterInstance.setAdaptive(enabled, minN, maxN, binSize, epsilon);
+    }
+
+    // Resample once the effective sample size drops below fraction * N (above 1: every update)
+    setResampleThreshold(fraction) {
+        this.sanityCheck();
+        this.filterInstance.setResampleThreshold(fraction);
+    }
+
+    // Resample on this many threads (0: all, 1: serial); needs the multi-threaded build to run in parallel
+    setResampleThreads(threads) {
+        this.sanityCheck();
+        this.filterInstance.setResampleThreads(threads);
+    }
+
+    // Fast math (polynomial exp/sincos, rsqrt) in the hot loops when true, exact library math otherwise
+    setFastMath(enabled) {
+        this.sanityCheck();
+        const Precision = FilterWrapper.module.Precision;
+        this.filterInstance.setPrecision(enabled ? Precision.Fast : Precision.Exact);
+    }
+
+    // 16-bit fixed-point particles when true (about a fifth of the per-filter memory), float particles otherwise
+    setCompactStorage(enabled) {
+        this.sanityCheck();
+        const ParticleStorage = FilterWrapper.module.ParticleStorage;
+        this.filterInstance.setStorage(enabled ? ParticleStorage.Fixed16 : ParticleStorage.Float);
+    }
+
+    // Initialize from the least squares fix of the last `history` ranges instead of a sphere around one anchor
+    setMultilaterationInit(enabled, history = 8, inflation = 4.0) {
+        this.sanityCheck();
+        const InitMode = FilterWrapper.module.InitMode;
+        this.filterInstance.setInitMode(enabled ? InitMode.Multilateration : InitMode.Sphere, history, inflation);
+    }
+
+    // On a weight collapse keep the cloud with tempered weights and replace only a fraction of it,
+    // between minFraction and maxFraction, with fresh particles instead of reinitializing
+    setCollapseRecovery(enabled, minFraction = 0.1, maxFraction = 0.5, minTempering = 0.01) {
+        this.sanityCheck();
+        this.filterInstance.setCollapseRecovery(enabled, minFraction, maxFraction, minTempering);
+    }
+
+    // Cumulative nanoseconds per phase (init, weighting, resample, estimate), reinitialization,
+    // resample and duplicate counts, and the last effective sample size
+    getStats() {
+        this.sanityCheck();
+        return this.filterInstance.getStats();
+    }
+
+    resetStats() {
+        this.sanityCheck();
+        this.filterInstance.resetStats();
+    }
+
+    // Uint8Array snapshot of the whole filter, quantized stores positions as 16-bit offsets from the estimate
+    serialize(quantized = false) {
+        this.sanityCheck();
+        return this.filterInstance.serialize(quantized);
+    }
+
+    // Restore a snapshot from serialize(), e.g. one posted from another worker
+    deserialize(bytes) {
+        this.sanityCheck();
+        this.filterInstance.deserialize(bytes);
+    }
+
     update(measure, P_NLOSS, estimatePos, estimateVar) {
         this.sanityCheck();
+        if (this.background) {
+            this.updateAsync(measure, P_NLOSS, estimatePos, estimateVar).delete();
+            return;
+        }
         const particleAvg = new FilterWrapper.module.particle();
         particleAvg.x = estimatePos.x;
         particleAvg.y = estimatePos.y;
@@ -81,6 +183,81 @@ class FilterWrapper {
         console.log(`estimateState call took ${endTime - startTime} milliseconds.`);
     }
 
+    // Queues the update on the worker and returns its handle (status(), isDone(), cancel()),
+    // which must be released with delete(). Only for filters created with background = true.
+    updateAsync(measure, P_NLOSS, estimatePos, estimateVar) {
+        this.sanityCheck();
+        if (!this.background) {
+            throw new Error("updateAsync needs a filter created with background = true");
+        }
+        const particleAvg = new FilterWrapper.module.particle();
+        particleAvg.x = estimatePos.x;
+        particleAvg.y = estimatePos.y;
+        particleAvg.z = estimatePos.z;
+        particleAvg.d = estimatePos.d;
+
+        const particleVar = new FilterWrapper.module.particle();
+        particleVar.x = estimateVar.x;
+        particleVar.y = estimateVar.y;
+        particleVar.z = estimateVar.z;
+        particleVar.d = estimateVar.d;
+
+        // the job holds copies of the particles, the JS handles can go
+        const handle = this.filterInstance.estimateStateAsync(measure, P_NLOSS, particleAvg, particleVar);
+        particleAvg.delete();
+        particleVar.delete();
+        return handle;
+    }
+
+    // Updates queued or running on the worker
+    pendingUpdates() {
+        this.sanityCheck();
+        return this.background ? this.filterInstance.getPendingUpdates() : 0;
+    }
+
+    // Drops the queued updates that have not started, returns how many were dropped
+    cancelPending() {
+        this.sanityCheck();
+        return this.background ? this.filterInstance.cancelPending() : 0;
+    }
+
+    // measures[i] is the range to the anchor at estimatePositions[i] with variance estimateVariances[i]
+    updateBatch(measures, estimatePositions, estimateVariances) {
+        this.sanityCheck();
+        const toParticle = (p) => {
+            const particle = new FilterWrapper.module.particle();
+            particle.x = p.x;
+            particle.y = p.y;
+            particle.z = p.z;
+            particle.d = p.d;
+            return particle;
+        };
+        const measurements = new FilterWrapper.module.VectorFloat();
+        const anchorAvgs = new FilterWrapper.module.VectorParticle();
+        const anchorVars = new FilterWrapper.module.VectorParticle();
+        // push_back copies the particle, the JS handle has to be released
+        const pushParticle = (vector, p) => {
+            const particle = toParticle(p);
+            vector.push_back(particle);
+            particle.delete();
+        };
+        for (let i = 0; i < measures.length; i++) {
+            measurements.push_back(measures[i]);
+            pushParticle(anchorAvgs, estimatePositions[i]);
+            pushParticle(anchorVars, estimateVariances[i]);
+        }
+
+        if (this.background) {
+            this.filterInstance.estimateStateBatchAsync(measurements, anchorAvgs, anchorVars).delete();
+        } else {
+            this.filterInstance.estimateStateBatch(measurements, anchorAvgs, anchorVars);
+        }
+
+        measurements.delete();
+        anchorAvgs.delete();
+        anchorVars.delete();
+    }
+
     getEstimatedPosition() {
         this.sanityCheck();
         const particle = this.filterInstance.getEstimateAvg();
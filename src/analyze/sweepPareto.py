@@ -0,0 +1,47 @@
+import os
+import sys
+import matplotlib.pyplot as plt
+import pandas as pd
+
+# Load the CSV file written by `make sweep`
+file_path = '../sweep.csv'
+if not os.path.exists(file_path):
+    print(file_path + ' not found, run `make sweep` first')
+    sys.exit(0)
+data = pd.read_csv(file_path)
+
+
+# Configurations no other configuration beats on both cost and error
+def pareto_front(points):
+    points = points.sort_values(['p50LatencyUs', 'meanFinalError'])
+    front = []
+    best = float('inf')
+    for _, row in points.iterrows():
+        if row['meanFinalError'] < best:
+            front.append(row)
+            best = row['meanFinalError']
+    return pd.DataFrame(front)
+
+
+# One chart per scenario geometry
+geometries = data.groupby(['layout', 'noise', 'depth'])
+fig, axes = plt.subplots(1, len(geometries), figsize=(7 * len(geometries), 6), squeeze=False)
+for ax, ((layout, noise, depth), points) in zip(axes[0], geometries):
+    for mode, group in points.groupby('mode'):
+        ax.scatter(group['p50LatencyUs'], group['meanFinalError'], label=mode)
+        for _, row in group.iterrows():
+            ax.annotate(str(row['N']), (row['p50LatencyUs'], row['meanFinalError']), fontsize=7)
+    front = pareto_front(points)
+    ax.plot(front['p50LatencyUs'], front['meanFinalError'], 'k--', label='Pareto front')
+    ax.set_xlabel('p50 update latency (us, log scale)')
+    ax.set_ylabel('Mean final error (m, log scale)')
+    ax.set_xscale('log')
+    ax.set_yscale('log')
+    ax.set_title('%s anchors, noise %g m, depth %d' % (layout, noise, depth))
+    ax.grid(True)
+    ax.legend()
+
+# Save the figure
+plt.tight_layout()
+plt.savefig('sweep_pareto.png')
+# plt.show()
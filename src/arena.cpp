@@ -0,0 +1,85 @@
+#include "arena.h"
+#include <new>
+#include <stdexcept>
+
+ParticleArena::ParticleArena(size_t chunkBytes) : chunkBytes(blockSize(chunkBytes)) {
+    if (chunkBytes == 0) {
+        throw std::invalid_argument("Arena chunks cannot be empty");
+    }
+}
+
+ParticleArena::~ParticleArena() {
+    for (void* chunk : chunks) {
+        ::operator delete(chunk, std::align_val_t(alignment));
+    }
+}
+
+size_t ParticleArena::blockSize(size_t bytes) {
+    size_t lines = (bytes + alignment - 1) / alignment;
+    if (lines <= 4) {
+        return lines * alignment;
+    }
+    // a quarter of the largest power of two below lines, so at most a quarter of a block is unused
+    size_t unit = 1;
+    while (unit * 8 <= lines) {
+        unit <<= 1;
+    }
+    return (lines + unit - 1) / unit * unit * alignment;
+}
+
+void* ParticleArena::allocate(size_t bytes) {
+    const size_t size = blockSize(bytes);
+    if (size == 0) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    used += size;
+    auto reusable = freeBlocks.find(size);
+    if (reusable != freeBlocks.end() && !reusable->second.empty()) {
+        void* block = reusable->second.back();
+        reusable->second.pop_back();
+        return block;
+    }
+    if (size > remaining) {
+        // a block larger than a chunk gets a chunk of its own, otherwise the tail of the current one is left
+        const size_t bytesNew = size > chunkBytes ? size : chunkBytes;
+        char* chunk;
+        try {
+            chunk = static_cast<char*>(::operator new(bytesNew, std::align_val_t(alignment)));
+        } catch (...) {
+            used -= size;
+            throw;
+        }
+        chunks.push_back(chunk);
+        reserved += bytesNew;
+        if (bytesNew == size) {
+            return chunk;
+        }
+        cursor = chunk;
+        remaining = bytesNew;
+    }
+    void* block = cursor;
+    cursor += size;
+    remaining -= size;
+    return block;
+}
+
+void ParticleArena::deallocate(void* block, size_t bytes) {
+    if (!block) {
+        return;
+    }
+    const size_t size = blockSize(bytes);
+    std::lock_guard<std::mutex> guard(lock);
+    used -= size;
+    freeBlocks[size].push_back(block);
+}
+
+size_t ParticleArena::reservedBytes() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return reserved;
+}
+
+size_t ParticleArena::usedBytes() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return used;
+}
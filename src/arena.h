@@ -0,0 +1,47 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Shared pool of cache-line aligned blocks for the particle arrays of many filters.
+// Blocks are carved from large chunks and rounded up to size classes (whole cache lines, then a
+// quarter of a power of two), so an array grows in place up to its class and a freed block is reused
+// for the next request of the same class instead of fragmenting the heap. Chunks are only returned
+// when the arena is destroyed, which happens once the last array drawing from it is gone.
+// Allocation takes a lock; it only happens when an array grows past its block.
+class ParticleArena {
+private:
+    size_t chunkBytes;
+    std::vector<void*> chunks;
+    // unused tail of the newest chunk
+    char* cursor = nullptr;
+    size_t remaining = 0;
+    std::unordered_map<size_t, std::vector<void*>> freeBlocks;
+    size_t reserved = 0;
+    size_t used = 0;
+    mutable std::mutex lock;
+
+public:
+    static const size_t alignment = 64;
+
+    explicit ParticleArena(size_t chunkBytes = size_t(1) << 20);
+    ~ParticleArena();
+    ParticleArena(const ParticleArena&) = delete;
+    ParticleArena& operator=(const ParticleArena&) = delete;
+
+    // Size of the block that serves a request of bytes
+    static size_t blockSize(size_t bytes);
+    // Block of blockSize(bytes) bytes, aligned to a cache line; null for 0 bytes
+    void* allocate(size_t bytes);
+    // Returns a block from allocate(bytes) for reuse
+    void deallocate(void* block, size_t bytes);
+
+    // Bytes taken from the system in chunks, and bytes of the blocks handed out
+    size_t reservedBytes() const;
+    size_t usedBytes() const;
+};
+
+#endif // ARENA_H
@@ -0,0 +1,230 @@
+#include "asyncFilter.h"
+
+UpdateStatus UpdateHandle::status() const {
+    if (!state) {
+        throw std::logic_error("Update handle is empty");
+    }
+    std::lock_guard<std::mutex> guard(state->lock);
+    return state->status;
+}
+
+bool UpdateHandle::done() const {
+    UpdateStatus s = status();
+    return s != UpdateStatus::Queued && s != UpdateStatus::Running;
+}
+
+uint64_t UpdateHandle::sequence() const {
+    if (!state) {
+        throw std::logic_error("Update handle is empty");
+    }
+    return state->sequence;
+}
+
+bool UpdateHandle::cancel() {
+    if (!state) {
+        throw std::logic_error("Update handle is empty");
+    }
+    std::lock_guard<std::mutex> guard(state->lock);
+    if (state->status != UpdateStatus::Queued) {
+        return false;
+    }
+    state->status = UpdateStatus::Cancelled;
+    state->finished.notify_all();
+    return true;
+}
+
+void UpdateHandle::wait() const {
+    if (!state) {
+        throw std::logic_error("Update handle is empty");
+    }
+    std::unique_lock<std::mutex> guard(state->lock);
+    state->finished.wait(guard, [&] {
+        return state->status != UpdateStatus::Queued && state->status != UpdateStatus::Running;
+    });
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
+
+AsyncFilter::AsyncFilter(int N, bool modelAntennaDelay, unsigned int seed) : filter(N, modelAntennaDelay, seed) {
+    publish(false);
+#if FILTER_THREADS
+    worker = std::thread(&AsyncFilter::workerLoop, this);
+#endif
+}
+
+AsyncFilter::~AsyncFilter() {
+    {
+        std::lock_guard<std::mutex> guard(queueLock);
+        stopping = true;
+        for (Job& job : queue) {
+            UpdateHandle(job.state).cancel();
+        }
+        queue.clear();
+    }
+    wake.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+UpdateHandle AsyncFilter::estimateStateAsync(float measurement, float P_NLoss, particle anchorAvg,
+                                             particle anchorVar) {
+    return submit({nullptr, {measurement}, {anchorAvg}, {anchorVar}, P_NLoss});
+}
+
+UpdateHandle AsyncFilter::estimateStateBatchAsync(const std::vector<float>& measurements,
+                                                  const std::vector<particle>& anchorAvgs,
+                                                  const std::vector<particle>& anchorVars) {
+    // checked here so the error reaches the caller rather than the handle
+    if (anchorAvgs.size() != measurements.size() || anchorVars.size() != measurements.size()) {
+        throw std::invalid_argument("Measurements and anchors must have the same length");
+    }
+    return submit({nullptr, measurements, anchorAvgs, anchorVars, 0.0f});
+}
+
+UpdateHandle AsyncFilter::submit(Job job) {
+    job.state = std::make_shared<UpdateHandle::State>();
+    UpdateHandle handle(job.state);
+    {
+        std::lock_guard<std::mutex> guard(queueLock);
+        job.state->sequence = ++nextSequence;
+#if FILTER_THREADS
+        queue.push_back(std::move(job));
+    }
+    wake.notify_one();
+#else
+    }
+    // without threads the only holder of the lock can be a withFilter call further up this stack
+    std::unique_lock<std::mutex> guard(filterLock, std::try_to_lock);
+    if (!guard.owns_lock()) {
+        throw std::logic_error("An update cannot be submitted from inside withFilter without thread support");
+    }
+    run(job);
+#endif
+    return handle;
+}
+
+// Runs a job the caller holds filterLock for, unless it was cancelled while queued
+void AsyncFilter::run(Job& job) {
+    {
+        std::lock_guard<std::mutex> guard(job.state->lock);
+        if (job.state->status != UpdateStatus::Queued) {
+            return;
+        }
+        job.state->status = UpdateStatus::Running;
+    }
+    UpdateStatus result = UpdateStatus::Done;
+    std::exception_ptr error;
+    try {
+        if (job.measurements.size() == 1) {
+            filter.estimateState(job.measurements[0], job.P_NLoss, job.anchorAvgs[0], job.anchorVars[0]);
+        } else {
+            filter.estimateStateBatch(job.measurements, job.anchorAvgs, job.anchorVars);
+        }
+        publish(true);
+    } catch (...) {
+        result = UpdateStatus::Failed;
+        error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> guard(job.state->lock);
+    job.state->status = result;
+    job.state->error = error;
+    job.state->finished.notify_all();
+}
+
+void AsyncFilter::publish(bool completed) {
+    std::lock_guard<std::mutex> guard(estimateLock);
+    completedAvg = filter.getEstimateAvg();
+    completedVar = filter.getEstimateVar();
+    completedN = filter.getN();
+    completedStats = filter.getStats();
+    if (completed) {
+        completedUpdates++;
+    }
+}
+
+void AsyncFilter::workerLoop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(queueLock);
+            wake.wait(guard, [&] { return stopping || !queue.empty(); });
+            if (stopping) {
+                return;
+            }
+        }
+        // take the filter first, so an update only counts as started once it can run
+        std::lock_guard<std::mutex> filterGuard(filterLock);
+        Job job;
+        {
+            std::lock_guard<std::mutex> guard(queueLock);
+            if (queue.empty()) {
+                continue;
+            }
+            job = std::move(queue.front());
+            queue.pop_front();
+            current = job.state;
+        }
+        run(job);
+        {
+            std::lock_guard<std::mutex> guard(queueLock);
+            current.reset();
+        }
+        idle.notify_all();
+    }
+}
+
+particle AsyncFilter::getEstimateAvg() const {
+    std::lock_guard<std::mutex> guard(estimateLock);
+    return completedAvg;
+}
+
+particle AsyncFilter::getEstimateVar() const {
+    std::lock_guard<std::mutex> guard(estimateLock);
+    return completedVar;
+}
+
+int AsyncFilter::getN() const {
+    std::lock_guard<std::mutex> guard(estimateLock);
+    return completedN;
+}
+
+FilterStats AsyncFilter::getStats() const {
+    std::lock_guard<std::mutex> guard(estimateLock);
+    return completedStats;
+}
+
+uint64_t AsyncFilter::getCompletedUpdates() const {
+    std::lock_guard<std::mutex> guard(estimateLock);
+    return completedUpdates;
+}
+
+int AsyncFilter::getPendingUpdates() const {
+    std::lock_guard<std::mutex> guard(queueLock);
+    int pending = 0;
+    if (current) {
+        std::lock_guard<std::mutex> stateGuard(current->lock);
+        pending += current->status == UpdateStatus::Running;
+    }
+    for (const Job& job : queue) {
+        std::lock_guard<std::mutex> stateGuard(job.state->lock);
+        pending += job.state->status == UpdateStatus::Queued;
+    }
+    return pending;
+}
+
+int AsyncFilter::cancelPending() {
+    std::lock_guard<std::mutex> guard(queueLock);
+    int cancelled = 0;
+    for (Job& job : queue) {
+        cancelled += UpdateHandle(job.state).cancel();
+    }
+    queue.clear();
+    idle.notify_all();
+    return cancelled;
+}
+
+void AsyncFilter::waitIdle() {
+    std::unique_lock<std::mutex> guard(queueLock);
+    idle.wait(guard, [&] { return queue.empty() && !current; });
+}
@@ -0,0 +1,128 @@
+#ifndef ASYNCFILTER_H
+#define ASYNCFILTER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "filter.h"
+
+enum class UpdateStatus { Queued, Running, Done, Cancelled, Failed };
+
+// Completion handle of one queued update, cheap to copy
+class UpdateHandle {
+public:
+    struct State {
+        std::mutex lock;
+        std::condition_variable finished;
+        UpdateStatus status = UpdateStatus::Queued;
+        std::exception_ptr error;
+        uint64_t sequence = 0;
+    };
+
+private:
+    std::shared_ptr<State> state;
+
+public:
+    UpdateHandle() = default;
+    explicit UpdateHandle(std::shared_ptr<State> state) : state(std::move(state)) {}
+
+    UpdateStatus status() const;
+    // Done, cancelled or failed
+    bool done() const;
+    // Position of the update in its filter's queue, starting at 1
+    uint64_t sequence() const;
+    // Drops the update if it has not started yet, returns whether it was dropped
+    bool cancel();
+    // Blocks until the update is done; rethrows the exception of a failed update
+    void wait() const;
+};
+
+// Filter updated by a background worker. Updates run one at a time in submission order while the
+// caller keeps going; the estimate getters return the last completed update without waiting for the
+// running one. Without thread support (single-threaded WASM build) updates run inside the call.
+class AsyncFilter {
+private:
+    struct Job {
+        std::shared_ptr<UpdateHandle::State> state;
+        std::vector<float> measurements;
+        std::vector<particle> anchorAvgs;
+        std::vector<particle> anchorVars;
+        float P_NLoss;
+    };
+
+    Filter filter;
+    // Held by whoever works on the filter: the worker during an update, withFilter otherwise
+    std::mutex filterLock;
+
+    mutable std::mutex queueLock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::deque<Job> queue;
+    // Update the worker is on, null when idle
+    std::shared_ptr<UpdateHandle::State> current;
+    bool stopping = false;
+    uint64_t nextSequence = 0;
+
+    mutable std::mutex estimateLock;
+    particle completedAvg = {0, 0, 0, 0};
+    particle completedVar = {0, 0, 0, 0};
+    int completedN = 0;
+    FilterStats completedStats;
+    uint64_t completedUpdates = 0;
+
+    std::thread worker;
+
+    UpdateHandle submit(Job job);
+    void run(Job& job);
+    void publish(bool completed);
+    void workerLoop();
+
+public:
+    explicit AsyncFilter(int N, bool modelAntennaDelay = true, unsigned int seed = Rng::defaultSeed);
+    // Cancels the queued updates and waits for the running one
+    ~AsyncFilter();
+    AsyncFilter(const AsyncFilter&) = delete;
+    AsyncFilter& operator=(const AsyncFilter&) = delete;
+
+    UpdateHandle estimateStateAsync(float measurement, float P_NLoss, particle anchorAvg, particle anchorVar);
+    UpdateHandle estimateStateBatchAsync(const std::vector<float>& measurements,
+                                         const std::vector<particle>& anchorAvgs,
+                                         const std::vector<particle>& anchorVars);
+
+    // Estimate after the last completed update, never waits for the worker
+    particle getEstimateAvg() const;
+    particle getEstimateVar() const;
+    // Particle count and statistics as of the last completed update or withFilter call, never wait either
+    int getN() const;
+    FilterStats getStats() const;
+    uint64_t getCompletedUpdates() const;
+    // Updates queued or running
+    int getPendingUpdates() const;
+
+    // Cancels every update that has not started, returns how many were dropped
+    int cancelPending();
+    // Blocks until the queue is empty and the worker is idle
+    void waitIdle();
+
+    // Runs fn on the filter between two updates, e.g. to configure it or take a snapshot; it blocks while
+    // an update is running. The published estimate, count and statistics are refreshed afterwards.
+    // fn must not call withFilter again. Without thread support it cannot submit updates either, the
+    // update would have to run inside fn: estimateState*Async then throws std::logic_error.
+    template <typename Fn>
+    auto withFilter(Fn fn) -> decltype(fn(std::declval<Filter&>())) {
+        std::lock_guard<std::mutex> guard(filterLock);
+        struct Publish {
+            AsyncFilter* self;
+            ~Publish() { self->publish(false); }
+        } publishOnExit{this};
+        return fn(filter);
+    }
+};
+
+#endif // ASYNCFILTER_H
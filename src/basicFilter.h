@@ -0,0 +1,232 @@
+#ifndef BASICFILTER_H
+#define BASICFILTER_H
+
+#include <cmath>
+#include <stdexcept>
+#include "kernels.h"
+#include "particles.h"
+#include "rng.h"
+
+// Particle count of a BasicFilter sized at run time
+const int dynamicN = 0;
+
+// The measurement update of Filter and BasicFilter: log-domain weights, a collapse handed to the core to recover
+// or reinitialize, and a resample only once the effective sample size drops below the threshold. The core
+// provides the weights, logWeights, resampleThreshold and precision members and these hooks:
+//   cloudSize()             particle count
+//   weigh(...)              accumulate the batch into logWeights and exponentiate, returns the sum of the weights
+//   trackEvidence(e)        sees the log evidence of every update
+//   recoverCollapse(...)    rewrites the log weights of a collapsed update, false to reinitialize
+//   reinitialize(...)       new cloud from the first measurement, then the update with the rest
+//   trackESS(ess)           sees the effective sample size of every update that is not reinitialized
+//   resample(sum_w, var)    normalize, resample with jitter scaled by var and update the estimates
+//   updateEstimates()       weighted estimates of the normalized cloud
+struct CloudUpdate {
+    template <class Core>
+    static void run(Core& core, const float* measurements, float P_NLoss, const particle* anchorAvgs,
+                    const particle* anchorVars, int k) {
+        if (k == 0) {
+            return;
+        }
+        const int n = core.cloudSize();
+        float maxLogWeight;
+        float sumSquares = 0.0f;
+        float sum_w = core.weigh(measurements, anchorAvgs, anchorVars, k, &maxLogWeight, &sumSquares);
+
+        // The log weights are kept at a mean weight of 1, so this is the log of the prior-weighted
+        // mean likelihood of the measurements, computed without underflow
+        float logEvidence = maxLogWeight + std::log(sum_w) - std::log(static_cast<float>(n));
+        core.trackEvidence(logEvidence);
+
+        // Weights too low (the sum_w <= 0.005 / N test in the log domain): recover the cloud when the core can,
+        // weigh the rewritten log weights again and carry on like any other update, or reinitialize
+        if (!(logEvidence > std::log(0.005f / n) - std::log(static_cast<float>(n)))) {
+            if (!core.recoverCollapse(measurements, anchorAvgs, anchorVars, k)) {
+                core.reinitialize(measurements, P_NLoss, anchorAvgs, anchorVars, k);
+                return;
+            }
+            maxLogWeight = -INFINITY;
+            for (int i = 0; i < n; i++) {
+                maxLogWeight = core.logWeights[i] > maxLogWeight ? core.logWeights[i] : maxLogWeight;
+            }
+            sum_w = exponentiateWeights(core.logWeights.data(), n, maxLogWeight, core.weights.data(), &sumSquares,
+                                        core.precision);
+            logEvidence = maxLogWeight + std::log(sum_w) - std::log(static_cast<float>(n));
+        }
+
+        // Resample only once the weights have degenerated
+        float ess = sum_w * sum_w / sumSquares;
+        core.trackESS(ess);
+        if (ess < core.resampleThreshold * n) {
+            // Jitter with the average variance of the anchors involved
+            particle jitterVar = {0, 0, 0, 0};
+            for (int j = 0; j < k; j++) {
+                jitterVar.x += anchorVars[j].x / k;
+                jitterVar.y += anchorVars[j].y / k;
+                jitterVar.z += anchorVars[j].z / k;
+                jitterVar.d += anchorVars[j].d / k;
+            }
+            core.resample(sum_w, jitterVar);
+            return;
+        }
+
+        // Keep the weighted cloud: normalize the weights and re-center the log weights
+        for (int i = 0; i < n; i++) {
+            core.weights[i] /= sum_w;
+            core.logWeights[i] -= logEvidence;
+        }
+        core.updateEstimates();
+    }
+};
+
+// Filter core with the delay model and, optionally, the particle count fixed at compile time.
+// ModelDelay = false drops the d array (12 bytes per particle) and every delay branch in the kernels.
+// A FixedN keeps every buffer inside the object, so small filters such as the N = 1 anchors of main.js
+// live on the stack without touching the heap. It runs the same kernels and CloudUpdate as Filter, which adds
+// adaptive N, stats, collapse recovery, parallel resampling and the bindings on top and picks the delay variant
+// at run time.
+// The buffers of a fixed-size filter point into the object itself, so it can be neither copied nor moved.
+template <bool ModelDelay, int FixedN = dynamicN>
+class BasicFilter {
+    friend struct CloudUpdate;
+    static_assert(FixedN >= 0, "FixedN must be a particle count or dynamicN");
+
+private:
+    static constexpr bool fixed = FixedN != dynamicN;
+    // per-array capacity of a fixed filter, padded like AlignedArray
+    static constexpr int fixedCapacity = (FixedN + AlignedArray::padding - 1) / AlignedArray::padding *
+                                         AlignedArray::padding;
+    // particles and back buffer, weights, log weights and 4 scratch arrays
+    static constexpr int arrays = 2 * (ModelDelay ? 4 : 3) + 2 + 4;
+
+    alignas(AlignedArray::alignment) float storage[fixed ? arrays * fixedCapacity : 1];
+    ParticleSet particles;
+    ParticleSet nextParticles;
+    AlignedArray weights;
+    AlignedArray logWeights;
+    AlignedArray scratch;
+    particle estimateAvg = {0, 0, 0, 0};
+    particle estimateVar = {0, 0, 0, 0};
+    float resampleThreshold = 0.5f;
+    Precision precision = defaultPrecision;
+    bool isInitialized = false;
+    Rng rng;
+
+    void bind(ParticleSet& set, float*& next) {
+        set.x = AlignedArray(next, fixedCapacity);
+        set.y = AlignedArray(next + fixedCapacity, fixedCapacity);
+        set.z = AlignedArray(next + 2 * fixedCapacity, fixedCapacity);
+        next += 3 * fixedCapacity;
+        if (ModelDelay) {
+            set.d = AlignedArray(next, fixedCapacity);
+            next += fixedCapacity;
+        }
+    }
+
+    void initParticles(float measurement, particle anchorAvg, particle anchorVar) {
+        initializeCloud(particles, measurement, anchorAvg, anchorVar, ModelDelay, rng, scratch.data(), precision,
+                        &estimateAvg, &estimateVar);
+        for (int i = 0; i < particles.size(); i++) {
+            logWeights[i] = 0.0f;
+        }
+        isInitialized = true;
+    }
+
+    // Hooks of CloudUpdate: no evidence trackers, stats or collapse recovery, a collapse reinitializes
+    int cloudSize() const { return particles.size(); }
+    float weigh(const float* measurements, const particle* anchorAvgs, const particle* anchorVars, int k,
+                float* maxLogWeight, float* sumSquares) {
+        *maxLogWeight = accumulateLogWeightsSimd(particles, measurements, anchorAvgs, anchorVars, k, ModelDelay,
+                                                 logWeights.data(), precision);
+        return exponentiateWeights(logWeights.data(), particles.size(), *maxLogWeight, weights.data(), sumSquares,
+                                   precision);
+    }
+    void trackEvidence(float) {}
+    bool recoverCollapse(const float*, const particle*, const particle*, int) { return false; }
+    void reinitialize(const float* measurements, float, const particle* anchorAvgs, const particle* anchorVars,
+                      int k) {
+        initParticles(measurements[0], anchorAvgs[0], anchorVars[0]);
+        update(measurements + 1, anchorAvgs + 1, anchorVars + 1, k - 1);
+    }
+    void trackESS(float) {}
+    void updateEstimates() { computeMoments(particles, weights.data(), &estimateAvg, &estimateVar); }
+
+    void update(const float* measurements, const particle* anchorAvgs, const particle* anchorVars, int k) {
+        CloudUpdate::run(*this, measurements, 0, anchorAvgs, anchorVars, k);
+    }
+
+    void resample(float sum_w, particle jitterVar) {
+        const int n = particles.size();
+        for (int i = 0; i < n; i++) {
+            weights[i] /= sum_w;
+        }
+        particle sigma = {std::sqrt(jitterVar.x) / 10, std::sqrt(jitterVar.y) / 10, std::sqrt(jitterVar.z) / 10,
+                          std::fmax(1e-7f, std::sqrt(jitterVar.d) / 10.0f)};
+        float r = rng.uniform() * (1.0f / n);
+        rng.fillGaussian(scratch.data(), ModelDelay ? 4 * n : 3 * n, 0.0f, 1.0f);
+        resampleSystematic(particles, weights.data(), n, r, scratch.data(), sigma, ModelDelay, nextParticles,
+                           &estimateAvg, &estimateVar);
+        particles.swap(nextParticles);
+        for (int i = 0; i < n; i++) {
+            logWeights[i] = 0.0f;
+        }
+    }
+
+public:
+    explicit BasicFilter(int N = FixedN, unsigned int seed = Rng::defaultSeed) : rng(seed) {
+        if (N < 1 || (fixed && N != FixedN)) {
+            throw std::invalid_argument("BasicFilter needs a positive N, equal to FixedN when it is set");
+        }
+        particles.delay = ModelDelay;
+        nextParticles.delay = ModelDelay;
+        if (fixed) {
+            float* next = storage;
+            bind(particles, next);
+            bind(nextParticles, next);
+            weights = AlignedArray(next, fixedCapacity);
+            logWeights = AlignedArray(next + fixedCapacity, fixedCapacity);
+            scratch = AlignedArray(next + 2 * fixedCapacity, 4 * fixedCapacity);
+        } else {
+            particles.reserve(N);
+            nextParticles.reserve(N);
+        }
+        particles.resize(N);
+        weights.resize(N);
+        logWeights.resize(N);
+        scratch.resize(4 * N);
+    }
+
+    BasicFilter(const BasicFilter&) = delete;
+    BasicFilter& operator=(const BasicFilter&) = delete;
+
+    int getN() const { return particles.size(); }
+    particle get(int i) const { return particles.get(i); }
+    const ParticleSet& getParticles() const { return particles; }
+    particle getEstimateAvg() const { return estimateAvg; }
+    particle getEstimateVar() const { return estimateVar; }
+    void setResampleThreshold(float fraction) { resampleThreshold = fraction; }
+    void setPrecision(Precision precision) { this->precision = precision; }
+    void seed(unsigned int seed) { rng.seed(seed); }
+
+    void estimateState(float measurement, particle anchorAvg, particle anchorVar) {
+        if (!isInitialized) {
+            initParticles(measurement, anchorAvg, anchorVar);
+            return;
+        }
+        update(&measurement, &anchorAvg, &anchorVar, 1);
+    }
+
+    void estimateStateBatch(const float* measurements, const particle* anchorAvgs, const particle* anchorVars, int k) {
+        if (k == 0) {
+            return;
+        }
+        int first = 0;
+        if (!isInitialized) {
+            initParticles(measurements[0], anchorAvgs[0], anchorVars[0]);
+            first = 1;
+        }
+        update(measurements + first, anchorAvgs + first, anchorVars + first, k - first);
+    }
+};
+
+#endif // BASICFILTER_H
@@ -0,0 +1,178 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "filter.h"
+#include "kernels.h"
+#include "rng.h"
+#include "threadPool.h"
+
+// Micro-benchmarks of the update phases, run with `make bench` (JSON written to bench.json).
+// Every phase is timed on its own for N = 100 ... 1,000,000 and reports particles per second.
+
+static const particle benchAnchor = {1.0f, 2.0f, 0.5f, 0.0f};
+static const particle benchAnchorVar = {0.1f, 0.1f, 0.1f, 0.0001f};
+static const float benchMeasurement = 5.0f;
+
+static void particleSizes(benchmark::internal::Benchmark* b) {
+    b->RangeMultiplier(10)->Range(100, 1000000);
+    b->MinWarmUpTime(0.1);
+    b->Repetitions(5);
+    b->ReportAggregatesOnly(true);
+    b->Unit(benchmark::kMicrosecond);
+}
+
+static void setThroughput(benchmark::State& state, int n) {
+    state.counters["particles/s"] = benchmark::Counter(n, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+// Particle cloud spread around the anchor, like after an initialization
+static ParticleSet makeCloud(int n) {
+    Rng rng;
+    ParticleSet particles;
+    particles.resize(n);
+    for (int i = 0; i < n; i++) {
+        particles.set(i, {rng.gaussian(4.0f, 2.0f), rng.gaussian(2.0f, 2.0f), rng.gaussian(0.5f, 2.0f),
+                          0.1f * rng.uniform()});
+    }
+    return particles;
+}
+
+static void BM_Init(benchmark::State& state) {
+    const int n = state.range(0);
+    Filter filter(n, true);
+    for (auto _ : state) {
+        filter.setN(n);
+        filter.estimateState(benchMeasurement, 0, benchAnchor, benchAnchorVar);
+        benchmark::DoNotOptimize(filter.getEstimateAvg());
+    }
+    setThroughput(state, n);
+}
+BENCHMARK(BM_Init)->Apply(particleSizes);
+
+static void weighting(benchmark::State& state, Precision precision) {
+    const int n = state.range(0);
+    ParticleSet particles = makeCloud(n);
+    AlignedArray logWeights(n);
+    AlignedArray weights(n);
+    for (auto _ : state) {
+        // the kernel accumulates, so start every iteration from zero without timing the reset
+        state.PauseTiming();
+        std::fill(logWeights.data(), logWeights.data() + n, 0.0f);
+        state.ResumeTiming();
+        float best = accumulateLogWeightsSimd(particles, &benchMeasurement, &benchAnchor, &benchAnchorVar, 1, true,
+                                              logWeights.data(), precision);
+        float sumSquares = 0.0f;
+        benchmark::DoNotOptimize(exponentiateWeights(logWeights.data(), n, best, weights.data(), &sumSquares,
+                                                     precision));
+    }
+    setThroughput(state, n);
+}
+
+static void BM_Weighting(benchmark::State& state) {
+    weighting(state, Precision::Exact);
+}
+BENCHMARK(BM_Weighting)->Apply(particleSizes);
+
+static void BM_WeightingFast(benchmark::State& state) {
+    weighting(state, Precision::Fast);
+}
+BENCHMARK(BM_WeightingFast)->Apply(particleSizes);
+
+static void BM_WeightingScalarReference(benchmark::State& state) {
+    const int n = state.range(0);
+    ParticleSet particles = makeCloud(n);
+    AlignedArray weights(n);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(computeWeightsScalar(particles, benchMeasurement, benchAnchor, benchAnchorVar, true,
+                                                      weights.data()));
+    }
+    setThroughput(state, n);
+}
+BENCHMARK(BM_WeightingScalarReference)->Apply(particleSizes);
+
+static void BM_Resample(benchmark::State& state) {
+    const int n = state.range(0);
+    ParticleSet particles = makeCloud(n);
+    AlignedArray weights(n);
+    float sum = computeWeightsSimd(particles, benchMeasurement, benchAnchor, benchAnchorVar, true, weights.data());
+    for (int i = 0; i < n; i++) {
+        weights[i] /= sum;
+    }
+    AlignedArray noise(4 * n);
+    Rng rng;
+    rng.fillGaussian(noise.data(), 4 * n, 0.0f, 1.0f);
+    const particle sigma = {0.03f, 0.03f, 0.03f, 0.001f};
+    ParticleSet out;
+    out.reserve(n);
+    particle avg, var;
+    for (auto _ : state) {
+        resampleSystematic(particles, weights.data(), n, 0.5f / n, noise.data(), sigma, true, out, &avg, &var);
+        benchmark::DoNotOptimize(out.x.data());
+        benchmark::DoNotOptimize(avg);
+        benchmark::ClobberMemory();
+    }
+    setThroughput(state, n);
+}
+BENCHMARK(BM_Resample)->Apply(particleSizes);
+
+static void BM_ResampleParallel(benchmark::State& state) {
+    const int n = state.range(0);
+    ParticleSet particles = makeCloud(n);
+    AlignedArray weights(n);
+    // the same inputs as BM_Resample; the kernel then redraws the noise from its per-segment streams
+    float sum = computeWeightsSimd(particles, benchMeasurement, benchAnchor, benchAnchorVar, true, weights.data());
+    for (int i = 0; i < n; i++) {
+        weights[i] /= sum;
+    }
+    AlignedArray cumulative(n);
+    AlignedArray noise(4 * n);
+    Rng rng;
+    rng.fillGaussian(noise.data(), 4 * n, 0.0f, 1.0f);
+    const particle sigma = {0.03f, 0.03f, 0.03f, 0.001f};
+    ThreadPool pool;
+    ParticleSet out;
+    out.reserve(n);
+    particle avg, var;
+    for (auto _ : state) {
+        resampleSystematicParallel(particles, weights.data(), cumulative.data(), n, 0.5f / n, 1, noise.data(), sigma,
+                                   true, out, &avg, &var, pool);
+        benchmark::DoNotOptimize(out.x.data());
+        benchmark::DoNotOptimize(avg);
+        benchmark::ClobberMemory();
+    }
+    setThroughput(state, n);
+    state.SetLabel(std::to_string(pool.size()) + " threads");
+}
+BENCHMARK(BM_ResampleParallel)->Apply(particleSizes);
+
+static void BM_UpdateEstimates(benchmark::State& state) {
+    const int n = state.range(0);
+    ParticleSet particles = makeCloud(n);
+    particle avg, var;
+    for (auto _ : state) {
+        computeMoments(particles, nullptr, &avg, &var);
+        benchmark::DoNotOptimize(avg);
+        benchmark::DoNotOptimize(var);
+    }
+    setThroughput(state, n);
+}
+BENCHMARK(BM_UpdateEstimates)->Apply(particleSizes);
+
+// Whole update on an initialized filter, resampling on every call as before the ESS gate
+static void BM_SteadyStateUpdate(benchmark::State& state) {
+    const int n = state.range(0);
+    Filter filter(n, true);
+    filter.setResampleThreshold(2.0f);
+    filter.estimateState(benchMeasurement, 0, benchAnchor, benchAnchorVar);
+    for (auto _ : state) {
+        filter.estimateState(benchMeasurement, 0, benchAnchor, benchAnchorVar);
+        benchmark::DoNotOptimize(filter.getEstimateAvg());
+    }
+    setThroughput(state, n);
+    state.SetLabel(simdBackend());
+}
+BENCHMARK(BM_SteadyStateUpdate)->Apply(particleSizes);
+
+BENCHMARK_MAIN();
@@ -1,8 +1,107 @@
 #include <emscripten/bind.h>
 #include "filter.h"
+#include "filterBank.h"
+#include "asyncFilter.h"
+#include "meshScheduler.h"
 
 using namespace emscripten;
 
+// Typed-array views straight into the WASM heap. They alias the filter's storage, so they
+// must be fetched again after every update, setN, or memory growth.
+static val particleView(const Filter& filter) {
+    const ParticleSet& particles = filter.getParticles();
+    const size_t n = particles.size();
+    val view = val::object();
+    view.set("layout", std::string("soa"));
+    view.set("count", n);
+    view.set("stride", 1);
+    view.set("x", val(typed_memory_view(n, particles.x.data())));
+    view.set("y", val(typed_memory_view(n, particles.y.data())));
+    view.set("z", val(typed_memory_view(n, particles.z.data())));
+    // empty when the filter does not model antenna delay
+    view.set("d", val(typed_memory_view(particles.d.size(), particles.d.data())));
+    return view;
+}
+
+// Interleaved xyz of every stride-th particle, ready for a BufferAttribute with itemSize 3
+static val positionView(Filter& filter, int stride) {
+    const int count = filter.packPositions(stride);
+    val view = val::object();
+    view.set("layout", std::string("xyz"));
+    view.set("count", count);
+    view.set("stride", stride);
+    view.set("itemSize", 3);
+    view.set("positions", val(typed_memory_view(3 * count, filter.getPackedPositions())));
+    return view;
+}
+
+// Snapshot copied into a fresh Uint8Array, which stays valid after the filter changes
+static val serializeFilter(const Filter& filter, bool quantized) {
+    std::vector<uint8_t> bytes = filter.serialize(quantized);
+    return val::global("Uint8Array").new_(typed_memory_view(bytes.size(), bytes.data()));
+}
+
+static void deserializeFilter(Filter& filter, const val& bytes) {
+    filter.deserialize(convertJSArrayToNumberVector<uint8_t>(bytes));
+}
+
+// Settings and snapshots of a background filter are applied between two updates
+static void asyncSetAdaptive(AsyncFilter& async, bool enabled, int minN, int maxN, float binSize, float epsilon) {
+    async.withFilter([&](Filter& filter) { filter.setAdaptive(enabled, minN, maxN, binSize, epsilon); });
+}
+
+static void asyncSetResampleThreshold(AsyncFilter& async, float fraction) {
+    async.withFilter([&](Filter& filter) { filter.setResampleThreshold(fraction); });
+}
+
+static void asyncSetResampleThreads(AsyncFilter& async, int threads) {
+    async.withFilter([&](Filter& filter) { filter.setResampleThreads(threads); });
+}
+
+static void asyncSetPrecision(AsyncFilter& async, Precision precision) {
+    async.withFilter([&](Filter& filter) { filter.setPrecision(precision); });
+}
+
+static void asyncSetStorage(AsyncFilter& async, ParticleStorage storage) {
+    async.withFilter([&](Filter& filter) { filter.setStorage(storage); });
+}
+
+static void asyncSetInitMode(AsyncFilter& async, InitMode mode, int history, float inflation) {
+    async.withFilter([&](Filter& filter) { filter.setInitMode(mode, history, inflation); });
+}
+
+static void asyncSetCollapseRecovery(AsyncFilter& async, bool enabled, float minFraction, float maxFraction,
+                                     float minTempering) {
+    async.withFilter(
+        [&](Filter& filter) { filter.setCollapseRecovery(enabled, minFraction, maxFraction, minTempering); });
+}
+
+// Particles and snapshots need the filter itself: they block while an update is running
+static particle asyncGet(AsyncFilter& async, int i) {
+    return async.withFilter([&](Filter& filter) { return filter.get(i); });
+}
+
+static val asyncSerialize(AsyncFilter& async, bool quantized) {
+    return async.withFilter([&](Filter& filter) { return serializeFilter(filter, quantized); });
+}
+
+static void asyncDeserialize(AsyncFilter& async, const val& bytes) {
+    std::vector<uint8_t> snapshot = convertJSArrayToNumberVector<uint8_t>(bytes);
+    async.withFilter([&](Filter& filter) { filter.deserialize(snapshot); });
+}
+
+static double asyncCompletedUpdates(const AsyncFilter& async) {
+    return static_cast<double>(async.getCompletedUpdates());
+}
+
+static double schedulerUpdates(const MeshScheduler& scheduler) {
+    return static_cast<double>(scheduler.getUpdates());
+}
+
+static double schedulerTicks(const MeshScheduler& scheduler) {
+    return static_cast<double>(scheduler.getTicks());
+}
+
 EMSCRIPTEN_BINDINGS(FilterModule) {
     class_<particle>("particle")
         .constructor<>()
@@ -11,13 +110,132 @@ EMSCRIPTEN_BINDINGS(FilterModule) {
         .property("z", &particle::z)
         .property("d", &particle::d);
 
+    enum_<Precision>("Precision")
+        .value("Exact", Precision::Exact)
+        .value("Fast", Precision::Fast);
+
+    enum_<InitMode>("InitMode")
+        .value("Sphere", InitMode::Sphere)
+        .value("Multilateration", InitMode::Multilateration);
+
+    enum_<ParticleStorage>("ParticleStorage")
+        .value("Float", ParticleStorage::Float)
+        .value("Fixed16", ParticleStorage::Fixed16);
+
+    value_object<FilterStats>("FilterStats")
+        .field("initNs", &FilterStats::initNs)
+        .field("weightingNs", &FilterStats::weightingNs)
+        .field("resampleNs", &FilterStats::resampleNs)
+        .field("estimateNs", &FilterStats::estimateNs)
+        .field("updates", &FilterStats::updates)
+        .field("reinitializations", &FilterStats::reinitializations)
+        .field("resamples", &FilterStats::resamples)
+        .field("proposals", &FilterStats::proposals)
+        .field("collapses", &FilterStats::collapses)
+        .field("reinjections", &FilterStats::reinjections)
+        .field("reinjectedParticles", &FilterStats::reinjectedParticles)
+        .field("duplicates", &FilterStats::duplicates)
+        .field("longestRun", &FilterStats::longestRun)
+        .field("lastESS", &FilterStats::lastESS);
+
+    register_vector<float>("VectorFloat");
+    register_vector<particle>("VectorParticle");
+
     class_<Filter>("Filter")
         .constructor<int, bool>()
+        .constructor<int, bool, unsigned int>()
         .function("get", &Filter::get)
         .function("set", &Filter::set)
         .function("getN", &Filter::getN)
         .function("setN", &Filter::setN)
+        .function("setAdaptive", &Filter::setAdaptive)
+        .function("isAdaptive", &Filter::isAdaptive)
+        .function("setResampleThreshold", &Filter::setResampleThreshold)
+        .function("getResampleThreshold", &Filter::getResampleThreshold)
+        .function("setResampleThreads", &Filter::setResampleThreads)
+        .function("getResampleThreads", &Filter::getResampleThreads)
         .function("estimateState", &Filter::estimateState)
+        .function("estimateStateBatch", &Filter::estimateStateBatch)
+        .function("setPrecision", &Filter::setPrecision)
+        .function("getPrecision", &Filter::getPrecision)
+        .function("setStorage", &Filter::setStorage)
+        .function("getStorage", &Filter::getStorage)
+        .function("setInitMode", &Filter::setInitMode)
+        .function("getInitMode", &Filter::getInitMode)
+        .function("setCollapseRecovery", &Filter::setCollapseRecovery)
+        .function("getCollapseRecovery", &Filter::getCollapseRecovery)
+        .function("getStats", &Filter::getStats)
+        .function("resetStats", &Filter::resetStats)
+        .function("seed", &Filter::seed)
+        .function("clone", &Filter::clone)
+        .function("serialize", &serializeFilter)
+        .function("deserialize", &deserializeFilter)
         .function("getEstimateAvg", &Filter::getEstimateAvg)
-        .function("getEstimateVar", &Filter::getEstimateVar);
+        .function("getEstimateVar", &Filter::getEstimateVar)
+        .function("getParticleView", &particleView)
+        .function("getPositionView", &positionView);
+
+    enum_<UpdateStatus>("UpdateStatus")
+        .value("Queued", UpdateStatus::Queued)
+        .value("Running", UpdateStatus::Running)
+        .value("Done", UpdateStatus::Done)
+        .value("Cancelled", UpdateStatus::Cancelled)
+        .value("Failed", UpdateStatus::Failed);
+
+    class_<UpdateHandle>("UpdateHandle")
+        .function("status", &UpdateHandle::status)
+        .function("isDone", &UpdateHandle::done)
+        .function("cancel", &UpdateHandle::cancel);
+
+    class_<AsyncFilter>("AsyncFilter")
+        .constructor<int, bool>()
+        .constructor<int, bool, unsigned int>()
+        .function("estimateStateAsync", &AsyncFilter::estimateStateAsync)
+        .function("estimateStateBatchAsync", &AsyncFilter::estimateStateBatchAsync)
+        .function("getEstimateAvg", &AsyncFilter::getEstimateAvg)
+        .function("getEstimateVar", &AsyncFilter::getEstimateVar)
+        .function("getCompletedUpdates", &asyncCompletedUpdates)
+        .function("getPendingUpdates", &AsyncFilter::getPendingUpdates)
+        .function("cancelPending", &AsyncFilter::cancelPending)
+        .function("get", &asyncGet)
+        .function("getN", &AsyncFilter::getN)
+        .function("setAdaptive", &asyncSetAdaptive)
+        .function("setResampleThreshold", &asyncSetResampleThreshold)
+        .function("setResampleThreads", &asyncSetResampleThreads)
+        .function("setPrecision", &asyncSetPrecision)
+        .function("setStorage", &asyncSetStorage)
+        .function("setInitMode", &asyncSetInitMode)
+        .function("setCollapseRecovery", &asyncSetCollapseRecovery)
+        .function("getStats", &AsyncFilter::getStats)
+        .function("serialize", &asyncSerialize)
+        .function("deserialize", &asyncDeserialize);
+
+    value_object<BankJob>("BankJob")
+        .field("node", &BankJob::node)
+        .field("measurement", &BankJob::measurement)
+        .field("neighbour", &BankJob::neighbour)
+        .field("anchorAvg", &BankJob::anchorAvg)
+        .field("anchorVar", &BankJob::anchorVar);
+    register_vector<BankJob>("VectorBankJob");
+
+    class_<FilterBank>("FilterBank")
+        .constructor<int, int, bool>()
+        .constructor<int, int, bool, unsigned int, int>()
+        .function("size", &FilterBank::size)
+        .function("threads", &FilterBank::threads)
+        .function("runRound", &FilterBank::runRound)
+        .function("getEstimateAvg", &FilterBank::getEstimateAvg)
+        .function("getEstimateVar", &FilterBank::getEstimateVar);
+
+    // The bank passed to the constructor must stay alive (not deleted) while the scheduler is used
+    class_<MeshScheduler>("MeshScheduler")
+        .constructor<FilterBank&>()
+        .constructor<FilterBank&, float>()
+        .function("addLink", &MeshScheduler::addLink)
+        .function("setMeasurement", &MeshScheduler::setMeasurement)
+        .function("linkCount", &MeshScheduler::linkCount)
+        .function("expectedGain", &MeshScheduler::expectedGain)
+        .function("tick", &MeshScheduler::tick)
+        .function("getTicks", &schedulerTicks)
+        .function("getUpdates", &schedulerUpdates);
 }
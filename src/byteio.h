@@ -0,0 +1,102 @@
+#ifndef BYTEIO_H
+#define BYTEIO_H
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// Little-endian encoding shared by the trace and snapshot formats, independent of the host byte order
+
+inline void putU32(unsigned char* out, uint32_t v) {
+    out[0] = v & 0xff;
+    out[1] = (v >> 8) & 0xff;
+    out[2] = (v >> 16) & 0xff;
+    out[3] = (v >> 24) & 0xff;
+}
+
+inline void putF32(unsigned char* out, float f) {
+    uint32_t v;
+    std::memcpy(&v, &f, sizeof(v));
+    putU32(out, v);
+}
+
+inline uint32_t getU32(const unsigned char* in) {
+    return uint32_t(in[0]) | uint32_t(in[1]) << 8 | uint32_t(in[2]) << 16 | uint32_t(in[3]) << 24;
+}
+
+inline float getF32(const unsigned char* in) {
+    uint32_t v = getU32(in);
+    float f;
+    std::memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+// Appends fields to a byte buffer
+class ByteWriter {
+private:
+    std::vector<uint8_t>& out;
+
+public:
+    explicit ByteWriter(std::vector<uint8_t>& out) : out(out) {}
+
+    void u16(uint16_t v) {
+        out.push_back(v & 0xff);
+        out.push_back(v >> 8);
+    }
+    void u32(uint32_t v) {
+        out.resize(out.size() + 4);
+        putU32(&out[out.size() - 4], v);
+    }
+    void f32(float f) {
+        out.resize(out.size() + 4);
+        putF32(&out[out.size() - 4], f);
+    }
+    void f32s(const float* v, size_t n) {
+        size_t at = out.size();
+        out.resize(at + 4 * n);
+        for (size_t i = 0; i < n; i++) {
+            putF32(&out[at + 4 * i], v[i]);
+        }
+    }
+    void bytes(const void* data, size_t n) {
+        size_t at = out.size();
+        out.resize(at + n);
+        std::memcpy(&out[at], data, n);
+    }
+};
+
+// Reads fields back in order, throws std::invalid_argument past the end of the buffer
+class ByteReader {
+private:
+    const uint8_t* data;
+    size_t length;
+    size_t offset = 0;
+
+public:
+    ByteReader(const uint8_t* data, size_t length) : data(data), length(length) {}
+
+    size_t remaining() const { return length - offset; }
+    const uint8_t* take(size_t n) {
+        if (n > remaining()) {
+            throw std::invalid_argument("Buffer is truncated");
+        }
+        const uint8_t* at = data + offset;
+        offset += n;
+        return at;
+    }
+    uint16_t u16() {
+        const uint8_t* in = take(2);
+        return uint16_t(in[0] | in[1] << 8);
+    }
+    uint32_t u32() { return getU32(take(4)); }
+    float f32() { return getF32(take(4)); }
+    void f32s(float* v, size_t n) {
+        const uint8_t* in = take(4 * n);
+        for (size_t i = 0; i < n; i++) {
+            v[i] = getF32(in + 4 * i);
+        }
+    }
+};
+
+#endif // BYTEIO_H
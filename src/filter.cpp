@@ -1,54 +1,90 @@
 #include "filter.h"
+#include "basicFilter.h"
+#include "byteio.h"
+#include "kernels.h"
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <cstring>
 
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
-float randomExponential(float lambda) {
-    float u = static_cast<float>(rand()) / RAND_MAX; // Uniform random value [0, 1)
-    return -std::log(1.0f - u) / lambda;
+float dist(particle p1, particle p2) {
+    float dx = p1.x - p2.x;
+    float dy = p1.y - p2.y;
+    float dz = p1.z - p2.z;
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
 }
 
-float randomGaussian(float mean, float stddev) {
-    static bool hasSpare = false;
-    static float spare;
-
-    if (hasSpare) {
-        hasSpare = false;
-        return mean + stddev * spare;
-    }
-
-    hasSpare = true;
-    float u, v, s;
-    do {
-        u = static_cast<float>(rand()) / RAND_MAX * 2.0f - 1.0f;
-        v = static_cast<float>(rand()) / RAND_MAX * 2.0f - 1.0f;
-        s = u * u + v * v;
-    } while (s >= 1.0f || s == 0.0f);
+// Update buffers of the Fixed16 filters run on one thread. They only hold data during a call, so a
+// fleet of compact filters keeps one copy per thread instead of one per filter. They always come from the
+// heap: a lease swaps them in and back out, and a resample copies next into the filter's own memory.
+struct SharedBuffers {
+    ParticleSet cloud;
+    CompactParticleSet next;
+    AlignedArray weights;
+    AlignedArray scratch;
+    bool leased = false;
+};
+static thread_local SharedBuffers shared;
 
-    s = std::sqrt(-2.0f * std::log(s) / s);
-    spare = v * s;
-    return mean + stddev * u * s;
-}
-
-float dist(particle p1, particle p2) {
-    return std::sqrt(
-        std::pow(p1.x - p2.x, 2) +
-        std::pow(p1.y - p2.y, 2) +
-        std::pow(p1.z - p2.z, 2)
-    );
-}
+// Swaps the shared buffers into a Fixed16 filter's empty members for the duration of a call,
+// nested calls keep the outer lease
+class SharedBufferLease {
+private:
+    ParticleSet* cloud = nullptr;
+    AlignedArray* weights;
+    AlignedArray* scratch;
 
+public:
+    SharedBufferLease(bool active, ParticleSet& cloud, AlignedArray& weights, AlignedArray& scratch, int capacity,
+                      bool delay)
+        : weights(&weights), scratch(&scratch) {
+        if (!active || shared.leased) {
+            return;
+        }
+        shared.leased = true;
+        this->cloud = &cloud;
+        cloud.swap(shared.cloud);
+        weights.swap(shared.weights);
+        scratch.swap(shared.scratch);
+        cloud.delay = delay;
+        cloud.reserve(capacity);
+        if (weights.size() < capacity) {
+            weights.resize(capacity);
+        }
+        if (scratch.size() < 4 * capacity) {
+            scratch.resize(4 * capacity);
+        }
+    }
+    ~SharedBufferLease() {
+        if (cloud) {
+            cloud->swap(shared.cloud);
+            weights->swap(shared.weights);
+            scratch->swap(shared.scratch);
+            shared.leased = false;
+        }
+    }
+    SharedBufferLease(const SharedBufferLease&) = delete;
+    SharedBufferLease& operator=(const SharedBufferLease&) = delete;
+};
 
+// Margin added to the spread covered by a Fixed16 cloud, so even a collapsed cloud keeps room for the
+// resampling jitter: 1 m on the position axes (30 um steps) and 0.1 on the relative delay
+static const particle compactMargin = {1.0f, 1.0f, 1.0f, 0.1f};
 
 // Constructor
-Filter::Filter(int N, bool modelAntennaDelay) {
+Filter::Filter(int N, bool modelAntennaDelay, unsigned int seed) : rng(seed) {
     this->N = N;
     this->modelAntennaDelay = modelAntennaDelay;
+    // without delay modelling the d array is never allocated
+    particles.delay = modelAntennaDelay;
+    nextParticles.delay = modelAntennaDelay;
+    compact.delay = modelAntennaDelay;
     try {
-        particles.resize(N, {0, 0, 0, 0}); // Potentially problematic for large N
+        allocateBuffers(N); // Potentially problematic for large N
     } catch (const std::bad_alloc &e) {
         std::cerr << "Memory allocation failed for N = " << N << ": " << e.what() << std::endl;
         throw;
@@ -56,19 +92,48 @@ Filter::Filter(int N, bool modelAntennaDelay) {
 }
 
 
+Filter::Filter(int N, bool modelAntennaDelay, unsigned int seed, std::shared_ptr<ParticleArena> arena)
+    : Filter(0, modelAntennaDelay, seed) {
+    setArena(std::move(arena));
+    this->N = N;
+    allocateBuffers(N);
+}
+
+Filter Filter::clone() const {
+    Filter copy(*this);
+    copy.telemetry = nullptr;
+    return copy;
+}
+
+void Filter::setArena(std::shared_ptr<ParticleArena> arena) {
+    this->arena = arena;
+    particles.setArena(arena);
+    nextParticles.setArena(arena);
+    weights.setArena(arena);
+    scratch.setArena(arena);
+    logWeights.setArena(arena);
+    packedPositions.setArena(arena);
+    cumulativeWeights.setArena(arena);
+    compact.setArena(arena);
+}
+
 particle Filter::get(int i) const {
-    if (i < 0 || i >= particles.size()) {
+    if (i < 0 || i >= N) {
         throw std::out_of_range("Index out of range");
     }
-    return particles[i];
+    return particleAt(i);
 }
 
 
 void Filter::set(int i, particle d) {
-    if (i < 0 || i >= particles.size()) {
+    if (i < 0 || i >= N) {
         throw std::out_of_range("Index out of range");
     }
-    particles[i] = d;
+    if (storage == ParticleStorage::Float) {
+        particles.set(i, d);
+    } else {
+        compact.set(i, d);
+    }
     // this->isInitialized = false;
 }
 
@@ -78,10 +143,120 @@ int Filter::getN() const {
 
 void Filter::setN(int N) {
     this->N = N;
-    this->particles.resize(N, {0, 0, 0, 0});
+    this->adaptive = false;
+    allocateBuffers(N);
     this->isInitialized = false;
 }
 
+void Filter::allocateBuffers(int capacity) {
+    // everything an update touches is sized here, so steady-state updates never allocate
+    if (storage == ParticleStorage::Fixed16) {
+        compact.reserve(capacity);
+        logWeights.reserve(capacity);
+        setActiveSize(this->N);
+        return;
+    }
+    particles.reserve(capacity);
+    nextParticles.reserve(capacity);
+    weights.reserve(capacity);
+    logWeights.reserve(capacity);
+    scratch.resize(4 * capacity);
+    if (resamplePool) {
+        cumulativeWeights.resize(capacity);
+    }
+    setActiveSize(this->N);
+}
+
+void Filter::setActiveSize(int n) {
+    this->N = n;
+    logWeights.resize(n);
+    if (storage == ParticleStorage::Fixed16) {
+        compact.resize(n);
+        return;
+    }
+    particles.resize(n);
+    weights.resize(n);
+}
+
+void Filter::setAdaptive(bool enabled, int minN, int maxN, float binSize, float epsilon) {
+    if (enabled && (minN < 1 || maxN < minN || binSize <= 0 || epsilon <= 0)) {
+        throw std::invalid_argument("Adaptive mode needs 1 <= minN <= maxN and positive bin size and epsilon");
+    }
+    this->adaptive = enabled;
+    if (!enabled) {
+        return;
+    }
+    this->minN = minN;
+    this->maxN = maxN;
+    this->kldBinSize = binSize;
+    this->kldEpsilon = epsilon;
+
+    // open addressing table with at least twice as many slots as particles
+    kldTableBits = 1;
+    while ((1 << kldTableBits) < 2 * maxN) {
+        kldTableBits++;
+    }
+    kldBins.assign(1 << kldTableBits, kldEmptyBin);
+    kldUsedSlots.resize(maxN);
+    allocateBuffers(maxN);
+}
+
+bool Filter::isAdaptive() const {
+    return this->adaptive;
+}
+
+bool Filter::hasEstimate() const {
+    return this->isInitialized;
+}
+
+int Filter::kldSampleCount() {
+    // Count the grid cells occupied by the particles that a systematic resample at the
+    // current size would keep, then size the next set with the KLD bound for that count.
+    const int n = N;
+    const float invBin = 1.0f / kldBinSize;
+    int k = 0;
+    float c = 0.0f;
+    int i = -1;
+    for (int m = 0; m < n; m++) {
+        float U = (m + 0.5f) / n;
+        int previous = i;
+        while (U > c && i < n - 1) {
+            i++;
+            c += weights[i];
+        }
+        if (i == previous) {
+            continue;
+        }
+        particle p = particleAt(i);
+        uint64_t ix = static_cast<int64_t>(std::floor(p.x * invBin)) & 0x1fffff;
+        uint64_t iy = static_cast<int64_t>(std::floor(p.y * invBin)) & 0x1fffff;
+        uint64_t iz = static_cast<int64_t>(std::floor(p.z * invBin)) & 0x1fffff;
+        uint64_t key = (ix << 42) | (iy << 21) | iz;
+        uint64_t slot = (key * 0x9e3779b97f4a7c15ULL) >> (64 - kldTableBits);
+        const uint64_t mask = kldBins.size() - 1;
+        while (kldBins[slot] != kldEmptyBin && kldBins[slot] != key) {
+            slot = (slot + 1) & mask;
+        }
+        if (kldBins[slot] == kldEmptyBin) {
+            kldBins[slot] = key;
+            kldUsedSlots[k++] = slot;
+        }
+    }
+    for (int s = 0; s < k; s++) {
+        kldBins[kldUsedSlots[s]] = kldEmptyBin;
+    }
+
+    if (k <= 1) {
+        return minN;
+    }
+    // Fox 2003: n = (k - 1) / (2 epsilon) * (1 - 2 / (9 (k - 1)) + sqrt(2 / (9 (k - 1))) z)^3
+    const double kldQuantile = 2.326; // upper 0.99 quantile of the standard normal
+    double a = 2.0 / (9.0 * (k - 1));
+    double b = 1.0 - a + std::sqrt(a) * kldQuantile;
+    double bound = std::ceil((k - 1) / (2.0 * kldEpsilon) * b * b * b);
+    return static_cast<int>(MIN(MAX(bound, minN), maxN));
+}
+
 particle Filter::getEstimateAvg() const {
     return this->estimateAvg;
 }
@@ -90,192 +265,781 @@ particle Filter::getEstimateVar() const {
     return this->estimateVar;
 }
 
+const ParticleSet& Filter::getParticles() const {
+    return this->particles;
+}
+
+int Filter::packPositions(int stride) {
+    if (stride < 1) {
+        throw std::invalid_argument("stride must be at least 1");
+    }
+    const int count = (N + stride - 1) / stride;
+    packedPositions.resize(3 * count);
+    for (int k = 0; k < count; k++) {
+        particle p = particleAt(k * stride);
+        packedPositions[3 * k] = p.x;
+        packedPositions[3 * k + 1] = p.y;
+        packedPositions[3 * k + 2] = p.z;
+    }
+    return count;
+}
 
+const float* Filter::getPackedPositions() const {
+    return packedPositions.data();
+}
 
+void Filter::setResampleThreshold(float fraction) {
+    this->resampleThreshold = fraction;
+}
 
-void Filter::initParticles(float measurement, float P_NLoss, particle anchorAvg, particle anchorVar) {
-    if (particles.empty()) {
-        throw std::runtime_error("Particles vector is empty. Initialize the particles before calling initParticles.");
+float Filter::getResampleThreshold() const {
+    return this->resampleThreshold;
+}
+
+void Filter::setResampleThreads(int threads) {
+    if (threads < 0) {
+        throw std::invalid_argument("Resample thread count must not be negative");
     }
+    this->resampleThreads = threads;
+    if (threads == 1) {
+        resamplePool.reset();
+        return;
+    }
+    resamplePool = std::make_shared<ThreadPool>(threads);
+    cumulativeWeights.resize(adaptive ? maxN : N);
+}
 
-    for (int i = 0; i < particles.size(); ++i) {
-        float ourAntennaDelay = 0.0f;
-        float adjustedDistance = measurement;
+int Filter::getResampleThreads() const {
+    return this->resampleThreads;
+}
 
-        // Step 1: Model antenna delay using exponential distribution
-        if (this->modelAntennaDelay) {
-            const float lambda = 10.0f; // 10 gives ~0.1 as the most likely value -> exponential distribution only used for initialization
+void Filter::setPrecision(Precision precision) {
+    this->precision = precision;
+}
 
-            // Generate our antenna delay in the range [0, 1)
-            do {
-                ourAntennaDelay = randomExponential(lambda);
-            } while (ourAntennaDelay >= 1.0f);
+Precision Filter::getPrecision() const {
+    return this->precision;
+}
 
-            // Adjust measurement for antenna delay
-            float otherAntennaDelay = randomGaussian(anchorAvg.d, std::sqrt(anchorVar.d));
-            float correctedMeasurement = measurement - otherAntennaDelay * measurement;
+void Filter::setStorage(ParticleStorage storage) {
+    if (storage == this->storage) {
+        return;
+    }
+    ParticleSet values;
+    values.delay = modelAntennaDelay;
+    values.resize(N);
+    for (int i = 0; i < N; i++) {
+        values.set(i, particleAt(i));
+    }
 
-            adjustedDistance = correctedMeasurement - ourAntennaDelay * measurement;
+    // drop the buffers of the old layout before allocating the new one
+    this->storage = storage;
+    particles = ParticleSet();
+    nextParticles = ParticleSet();
+    compact = CompactParticleSet();
+    weights = AlignedArray();
+    scratch = AlignedArray();
+    setArena(arena);
+    particles.delay = nextParticles.delay = compact.delay = modelAntennaDelay;
+    allocateBuffers(adaptive ? maxN : N);
+    if (storage == ParticleStorage::Fixed16) {
+        compact.setScale(estimateAvg, estimateVar, compactMargin);
+    }
+    for (int i = 0; i < N; i++) {
+        set(i, values.get(i));
+    }
+}
 
-            // Ensure non-negative adjusted distance
-            if (adjustedDistance < 0) {
-                adjustedDistance = measurement;
-            }
-        } else {
-            // Add Gaussian noise to the measurement directly -> lets move this to the coordinates
-            adjustedDistance = measurement;// + randomGaussian(0, std::sqrt(anchorVar.d));
-        }
+ParticleStorage Filter::getStorage() const {
+    return this->storage;
+}
+
+void Filter::setInitMode(InitMode mode, int history, float inflation) {
+    const int unknowns = modelAntennaDelay ? 4 : 3;
+    if (mode == InitMode::Multilateration && (history <= unknowns || !(inflation > 0))) {
+        throw std::invalid_argument("Multilateration needs more ranges than unknowns and a positive inflation");
+    }
+    this->initMode = mode;
+    this->proposalInflation = inflation;
+    this->proposalPending = false;
+    historyCount = 0;
+    historyNext = 0;
+    const int size = mode == InitMode::Multilateration ? history : 0;
+    historyMeasurements.assign(size, 0.0f);
+    historyAvgs.assign(size, {0, 0, 0, 0});
+    historyVars.assign(size, {0, 0, 0, 0});
+    fixMeasurements.resize(size);
+    fixAvgs.resize(size);
+    fixVars.resize(size);
+}
+
+InitMode Filter::getInitMode() const {
+    return this->initMode;
+}
+
+void Filter::setCollapseRecovery(bool enabled, float minFraction, float maxFraction, float minTempering) {
+    if (enabled && !(0 < minFraction && minFraction <= maxFraction && maxFraction < 1 && 0 < minTempering &&
+                     minTempering <= 1)) {
+        throw std::invalid_argument("Collapse recovery needs 0 < minFraction <= maxFraction < 1 and "
+                                    "minTempering in (0, 1]");
+    }
+    this->collapseRecovery = enabled;
+    if (enabled) {
+        this->reinjectMinFraction = minFraction;
+        this->reinjectMaxFraction = maxFraction;
+        this->minTempering = minTempering;
+    }
+}
 
-        // Step 2: Handle P_NLoss
-        // if (static_cast<float>(rand()) / RAND_MAX < P_NLoss) {
-        //     // Add constant error or Gaussian noise to simulate loss
-        //     adjustedDistance += randomGaussian(5.0f, 1.0f); // how should we choose these values?
-        // }
+bool Filter::getCollapseRecovery() const {
+    return this->collapseRecovery;
+}
 
-        // Step 3: Initialize the particle's position using spherical coordinates
-        float azimuthalAngle = static_cast<float>(rand()) / RAND_MAX * 2.0f * M_PI; // 0 to 2π
-        float polarAngle = static_cast<float>(rand()) / RAND_MAX * M_PI;           // 0 to π
+void Filter::rememberRanges(const float* measurements, const particle* anchorAvgs, const particle* anchorVars,
+                            int k) {
+    const int size = historyMeasurements.size();
+    for (int j = 0; j < k; j++) {
+        historyMeasurements[historyNext] = measurements[j];
+        historyAvgs[historyNext] = anchorAvgs[j];
+        historyVars[historyNext] = anchorVars[j];
+        historyNext = (historyNext + 1) % size;
+    }
+    historyCount = MIN(historyCount + k, size);
+}
 
-        float sinPolar = std::sin(polarAngle);
-        float cosPolar = std::cos(polarAngle);
-        float sinAzimuthal = std::sin(azimuthalAngle);
-        float cosAzimuthal = std::cos(azimuthalAngle);
+FilterStats Filter::getStats() const {
+    return this->stats;
+}
 
-        float x = anchorAvg.x + randomGaussian(0, std::sqrt(anchorVar.x)) + adjustedDistance * sinPolar * cosAzimuthal;
-        float y = anchorAvg.y + randomGaussian(0, std::sqrt(anchorVar.y)) + adjustedDistance * sinPolar * sinAzimuthal;
-        float z = anchorAvg.z + randomGaussian(0, std::sqrt(anchorVar.z)) + adjustedDistance * cosPolar;
+void Filter::resetStats() {
+    this->stats = FilterStats();
+}
 
+void Filter::seed(unsigned int seed) {
+    this->rng.seed(seed);
+}
 
-        // Step 4: Assign properties to the particle
-        particles[i] = {x, y, z, ourAntennaDelay};
+void Filter::setTraceRecorder(std::shared_ptr<TraceWriter> recorder, uint32_t node) {
+    trace = std::move(recorder);
+    traceNode = node;
+}
+
+void Filter::setTelemetry(std::shared_ptr<TelemetryRing> ring, uint32_t node) {
+    telemetry = std::move(ring);
+    telemetryNode = node;
+}
+
+// Pushes the telemetry record of an update when it goes out of scope, whichever way the update ends
+class Filter::TelemetryScope {
+private:
+    Filter* filter;
+    uint32_t measurements;
+    FilterStats before;
+
+public:
+    TelemetryScope(Filter& filter, uint32_t measurements)
+        : filter(filter.telemetry ? &filter : nullptr), measurements(measurements) {
+        if (this->filter) {
+            before = filter.stats;
+        }
+    }
+    ~TelemetryScope() {
+        if (!filter) {
+            return;
+        }
+        const FilterStats& after = filter->stats;
+        TelemetryRecord record;
+        record.node = filter->telemetryNode;
+        record.measurements = measurements;
+        record.timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 std::chrono::steady_clock::now().time_since_epoch())
+                                 .count();
+        record.avg = filter->estimateAvg;
+        record.var = filter->estimateVar;
+        record.initNs = static_cast<float>(after.initNs - before.initNs);
+        record.weightingNs = static_cast<float>(after.weightingNs - before.weightingNs);
+        record.resampleNs = static_cast<float>(after.resampleNs - before.resampleNs);
+        record.estimateNs = static_cast<float>(after.estimateNs - before.estimateNs);
+        filter->telemetry->push(record);
     }
+    TelemetryScope(const TelemetryScope&) = delete;
+    TelemetryScope& operator=(const TelemetryScope&) = delete;
+};
 
-    // Step 5: Compute estimate average and variance
-    updateEstimates();
 
-    isInitialized = true;
+
+
+void Filter::initParticles(float measurement, float P_NLoss, particle anchorAvg, particle anchorVar) {
+    if (N < 1) {
+        throw std::runtime_error("Particles vector is empty. Initialize the particles before calling initParticles.");
+    }
+    FILTER_STAT(PhaseTimer timer(stats.initNs));
+    SharedBufferLease lease(storage == ParticleStorage::Fixed16, particles, weights, scratch, adaptive ? maxN : N,
+                            modelAntennaDelay);
+
+    // adaptive filters restart from the largest cloud
+    if (adaptive) {
+        setActiveSize(maxN);
+    }
+    // Fixed16 builds the cloud in the borrowed float set
+    particles.resize(N);
+    initializeCloud(particles, measurement, anchorAvg, anchorVar, modelAntennaDelay, rng, scratch.data(), precision,
+                    &estimateAvg, &estimateVar);
+    finishInit();
+    proposalPending = initMode == InitMode::Multilateration;
 }
 
+// Least squares fix of the remembered ranges, false when they do not fix a position
+bool Filter::fixFromHistory(RangeFix* fix) {
+    const int unknowns = modelAntennaDelay ? 4 : 3;
+    if (initMode != InitMode::Multilateration || historyCount <= unknowns) {
+        return false;
+    }
+    const int size = historyMeasurements.size();
+    for (int j = 0; j < historyCount; j++) {
+        int slot = (historyNext - historyCount + j + size) % size;
+        fixMeasurements[j] = historyMeasurements[slot];
+        fixAvgs[j] = historyAvgs[slot];
+        fixVars[j] = historyVars[slot];
+    }
+    // drop the oldest ranges until the rest agree, within 3 standard deviations per degree of freedom
+    int first = 0;
+    while (historyCount - first > unknowns &&
+           !(multilaterate(&fixMeasurements[first], &fixAvgs[first], &fixVars[first], historyCount - first,
+                           modelAntennaDelay, fix) && fix->chi2 <= 9.0 * fix->dof)) {
+        first++;
+    }
+    return historyCount - first > unknowns;
+}
 
-void Filter::updateEstimates() {
-    // this update strategy uses frequency rather than weights
-    float x = 0.0f, y = 0.0f, z = 0.0f, d = 0.0f;
-    float varx = 0.0f, vary = 0.0f, varz = 0.0f, vard = 0.0f;
+// Proposal cloud around the fix of the remembered ranges; false, leaving the filter alone, when they do not
+// fix a position
+bool Filter::initFromHistory() {
+    RangeFix fix;
+    if (!fixFromHistory(&fix)) {
+        return false;
+    }
 
-    // Update the estimate average
-    for (const auto& p : particles) {
-        x += p.x;
-        y += p.y;
-        z += p.z;
-        d += p.d;
+    FILTER_STAT(PhaseTimer timer(stats.initNs));
+    FILTER_STAT(stats.proposals++);
+    SharedBufferLease lease(storage == ParticleStorage::Fixed16, particles, weights, scratch, adaptive ? maxN : N,
+                            modelAntennaDelay);
+    if (adaptive) {
+        setActiveSize(maxN);
     }
-    estimateAvg = {x / particles.size(), y / particles.size(), z / particles.size(), d / particles.size()};
+    particles.resize(N);
+    sampleFix(particles, fix, proposalInflation, modelAntennaDelay, rng, scratch.data(), &estimateAvg, &estimateVar);
+    finishInit();
+    proposalPending = false;
+    return true;
+}
 
-    // Update the estimate variance
-    for (const auto& p : particles) {
-        varx += std::pow(p.x - estimateAvg.x, 2);
-        vary += std::pow(p.y - estimateAvg.y, 2);
-        varz += std::pow(p.z - estimateAvg.z, 2);
-        vard += std::pow(p.d - estimateAvg.d, 2);
+// Encodes a new cloud when compact and restarts from equal weights
+void Filter::finishInit() {
+    const int n = N;
+    if (storage == ParticleStorage::Fixed16) {
+        compact.setScale(estimateAvg, estimateVar, compactMargin);
+        for (int i = 0; i < n; i++) {
+            compact.set(i, particles.get(i));
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        logWeights[i] = 0.0f;
+    }
+    isInitialized = true;
+}
+
+
+void Filter::updateEstimates() {
+    // weighted estimate when the weights are kept; init and resample compute theirs while writing the particles
+    FILTER_STAT(PhaseTimer timer(stats.estimateNs));
+    if (storage == ParticleStorage::Fixed16) {
+        computeMoments(compact, weights.data(), &estimateAvg, &estimateVar);
+    } else {
+        computeMoments(particles, weights.data(), &estimateAvg, &estimateVar);
     }
-    estimateVar = {varx / particles.size(), vary / particles.size(), varz / particles.size(), vard / particles.size()};
 }
 
 void Filter::estimateState(float measurement, float P_NLoss, particle anchorAvg, particle anchorVar) {
+    TelemetryScope telemetryScope(*this, 1);
+    if (trace) {
+        trace->record(traceNode, &measurement, P_NLoss, &anchorAvg, &anchorVar, 1);
+    }
+    if (initMode == InitMode::Multilateration) {
+        rememberRanges(&measurement, &anchorAvg, &anchorVar, 1);
+    }
+    SharedBufferLease lease(storage == ParticleStorage::Fixed16, particles, weights, scratch, adaptive ? maxN : N,
+                            modelAntennaDelay);
+    // a proposal already accounts for this measurement
+    if ((!isInitialized || proposalPending) && initFromHistory()) {
+        return;
+    }
     if (!isInitialized) {
         // Initialize particles if not already initialized
         initParticles(measurement, P_NLoss, anchorAvg, anchorVar);
         return;
     }
 
-    std::vector<float> weights(particles.size(), 0.0f);
-    float sum_w = 0.0f;
-
-    // Update particle weights based on measurement
-    for (int i = 0; i < particles.size(); i++) {
-        float distance = dist(particles[i], anchorAvg);
-
-        // Compute error, including delay error component if modeled
-        float ourDelayErrorComponent = modelAntennaDelay ? particles[i].d * measurement : 0.0f;
-        float anchorDelayErrorComponent = modelAntennaDelay ? anchorAvg.d * measurement : 0.0f;
-        float rerror = measurement - (distance + ourDelayErrorComponent + anchorDelayErrorComponent);
-        float error = std::abs(rerror);
-
-        float dx = particles[i].x - anchorAvg.x;
-        float dy = particles[i].y - anchorAvg.y;
-        float dz = particles[i].z - anchorAvg.z;
-
-        // Compute the total 3D distance
-        float norm = std::sqrt(dx * dx + dy * dy + dz * dz);
-        // Avoid division by zero for zero distance
-        if (norm == 0.0f) norm = 1e-6f;
-        // Normalize the vector difference
-        float nx = dx / norm;
-        float ny = dy / norm;
-        float nz = dz / norm;
-
-        float e_x = nx * rerror;
-        float e_y = ny * rerror;
-        float e_z = nz * rerror;
-        const float regFactor = 1e-6f;
-        // Compute the likelihood using per-axis variances
-        float likelihood = std::exp(
-            -0.5f * (
-                (e_x * e_x) / (anchorVar.x + regFactor) +
-                (e_y * e_y) / (anchorVar.y + regFactor) +
-                (e_z * e_z) / (anchorVar.z + regFactor)
-            )
-        );
-
-        // Update particle weight
-        weights[i] = likelihood;
-        sum_w += likelihood;
-    }
-
-    // std::cout << "Sum of weights: " << sum_w << std::endl;
-    // Reinitialize particles if weights are too low
-    if (sum_w <= 0.005f / particles.size()) {
-        // std::cout << "Resampling due to low weights" << std::endl;
-        initParticles(measurement, P_NLoss, anchorAvg, anchorVar);
+    FILTER_STAT(stats.updates++);
+    updateBatch(&measurement, P_NLoss, &anchorAvg, &anchorVar, 1);
+}
+
+void Filter::estimateStateBatch(const std::vector<float>& measurements, const std::vector<particle>& anchorAvgs,
+                                const std::vector<particle>& anchorVars) {
+    if (measurements.size() != anchorAvgs.size() || measurements.size() != anchorVars.size()) {
+        throw std::invalid_argument("estimateStateBatch needs one anchor average and variance per measurement");
+    }
+    if (measurements.empty()) {
+        return;
+    }
+    TelemetryScope telemetryScope(*this, measurements.size());
+    if (trace) {
+        trace->record(traceNode, measurements.data(), 0, anchorAvgs.data(), anchorVars.data(), measurements.size());
+    }
+
+    if (initMode == InitMode::Multilateration) {
+        rememberRanges(measurements.data(), anchorAvgs.data(), anchorVars.data(), measurements.size());
+    }
+    SharedBufferLease lease(storage == ParticleStorage::Fixed16, particles, weights, scratch, adaptive ? maxN : N,
+                            modelAntennaDelay);
+    if ((!isInitialized || proposalPending) && initFromHistory()) {
         return;
     }
+    int first = 0;
+    if (!isInitialized) {
+        // Initialize from the first measurement and weight the cloud with the rest
+        initParticles(measurements[0], 0, anchorAvgs[0], anchorVars[0]);
+        first = 1;
+    }
+    FILTER_STAT(stats.updates++);
+    updateBatch(measurements.data() + first, 0, anchorAvgs.data() + first, anchorVars.data() + first,
+                measurements.size() - first);
+}
+
+void Filter::updateBatch(const float* measurements, float P_NLoss, const particle* anchorAvgs,
+                         const particle* anchorVars, int k) {
+    CloudUpdate::run(*this, measurements, P_NLoss, anchorAvgs, anchorVars, k);
+}
+
+// Update the persistent log weights based on the measurements, then exponentiate relative to the maximum
+float Filter::weigh(const float* measurements, const particle* anchorAvgs, const particle* anchorVars, int k,
+                    float* maxLogWeight, float* sumSquares) {
+    FILTER_STAT(PhaseTimer weighting(stats.weightingNs));
+    *maxLogWeight = storage == ParticleStorage::Fixed16
+                        ? accumulateLogWeightsSimd(compact, measurements, anchorAvgs, anchorVars, k,
+                                                   modelAntennaDelay, logWeights.data(), precision)
+                        : accumulateLogWeightsSimd(particles, measurements, anchorAvgs, anchorVars, k,
+                                                   modelAntennaDelay, logWeights.data(), precision);
+    return exponentiateWeights(logWeights.data(), N, *maxLogWeight, weights.data(), sumSquares, precision);
+}
 
-    // Normalize weights
-    for (int i=0;i<weights.size();i++){
-        weights[i] /= sum_w;
+// Augmented MCL style trackers of the evidence, for the re-injected fraction
+void Filter::trackEvidence(float logEvidence) {
+    const double evidence = std::exp(static_cast<double>(logEvidence));
+    evidenceFast += 0.1 * (evidence - evidenceFast);
+    evidenceSlow += 0.01 * (evidence - evidenceSlow);
+}
+
+void Filter::reinitialize(const float* measurements, float P_NLoss, const particle* anchorAvgs,
+                          const particle* anchorVars, int k) {
+    FILTER_STAT(stats.reinitializations++);
+    // the remembered ranges include these measurements
+    if (initFromHistory()) {
+        return;
     }
+    initParticles(measurements[0], P_NLoss, anchorAvgs[0], anchorVars[0]);
+    updateBatch(measurements + 1, P_NLoss, anchorAvgs + 1, anchorVars + 1, k - 1);
+}
+
+void Filter::trackESS(float ess) {
+    FILTER_STAT(stats.lastESS = ess);
+}
+
+// Called with the log weights updated by a collapsed batch; rewrites them (and part of the cloud) so the
+// update can go on, or returns false to reinitialize. Uses scratch, and nextParticles or the borrowed
+// float set for the fresh particles, so it does not allocate either.
+bool Filter::recoverCollapse(const float* measurements, const particle* anchorAvgs, const particle* anchorVars,
+                             int k) {
+    FILTER_STAT(stats.collapses++);
+    if (!collapseRecovery) {
+        return false;
+    }
+    const int n = N;
+    float* increment = scratch.data();
+    float* tempered = increment + n;
+    float* temperedWeights = tempered + n;
+
+    // Split the log weights back into the prior and the log-likelihood of the batch
+    for (int i = 0; i < n; i++) {
+        increment[i] = 0.0f;
+    }
+    if (storage == ParticleStorage::Fixed16) {
+        accumulateLogWeightsSimd(compact, measurements, anchorAvgs, anchorVars, k, modelAntennaDelay, increment,
+                                 precision);
+    } else {
+        accumulateLogWeightsSimd(particles, measurements, anchorAvgs, anchorVars, k, modelAntennaDelay, increment,
+                                 precision);
+    }
+    for (int i = 0; i < n; i++) {
+        logWeights[i] -= increment[i];
+    }
+    auto temperedESS = [&](float beta) {
+        float largest = -INFINITY;
+        for (int i = 0; i < n; i++) {
+            tempered[i] = logWeights[i] + beta * increment[i];
+            largest = MAX(largest, tempered[i]);
+        }
+        float sumSquares = 0.0f;
+        float sum = exponentiateWeights(tempered, n, largest, temperedWeights, &sumSquares, precision);
+        return sum * sum / sumSquares;
+    };
+
+    // Survivors: the largest exponent on the batch likelihood that keeps the effective sample size, by bisection
+    const float target = temperingESS * n;
+    float beta = minTempering;
+    if (temperedESS(minTempering) >= target) {
+        float hi = 1.0f;
+        for (int step = 0; step < 12; step++) {
+            float mid = 0.5f * (beta + hi);
+            (temperedESS(mid) >= target ? beta : hi) = mid;
+        }
+    }
+    float largest = -INFINITY;
+    for (int i = 0; i < n; i++) {
+        logWeights[i] += beta * increment[i];
+        largest = MAX(largest, logWeights[i]);
+    }
+    if (n < 2) {
+        return true;
+    }
+
+    // Fresh particles replace the lightest ones, more of them while the short-run evidence stays behind
+    // the long-run one
+    double ratio = evidenceSlow > 0.0 ? evidenceFast / evidenceSlow : 0.0;
+    float fraction = static_cast<float>(MIN(MAX(1.0 - ratio, reinjectMinFraction), reinjectMaxFraction));
+    const int fresh = MIN(n - 1, MAX(1, static_cast<int>(std::lround(fraction * n))));
+    std::copy(logWeights.data(), logWeights.data() + n, tempered);
+    std::nth_element(tempered, tempered + fresh - 1, tempered + n);
+    const float cutoff = tempered[fresh - 1];
+
+    // Fresh particles from the init mode, in a float set that is free at this point
+    ParticleSet& freshSet = storage == ParticleStorage::Fixed16 ? particles : nextParticles;
+    freshSet.resize(fresh);
+    particle freshAvg, freshVar;
+    RangeFix fix;
+    if (initMode == InitMode::Multilateration && fixFromHistory(&fix)) {
+        sampleFix(freshSet, fix, proposalInflation, modelAntennaDelay, rng, scratch.data(), &freshAvg, &freshVar);
+    } else {
+        initializeCloud(freshSet, measurements[0], anchorAvgs[0], anchorVars[0], modelAntennaDelay, rng,
+                        scratch.data(), precision, &freshAvg, &freshVar);
+    }
+    if (storage == ParticleStorage::Fixed16) {
+        // widen the encoding to the mixture of the kept and the fresh particles
+        particle keptAvg, keptVar;
+        computeMoments(compact, nullptr, &keptAvg, &keptVar);
+        auto mix = [](float m1, float v1, float m2, float v2) {
+            float half = 0.5f * (m1 - m2);
+            return 0.5f * (v1 + v2) + half * half;
+        };
+        compact.rescale({0.5f * (keptAvg.x + freshAvg.x), 0.5f * (keptAvg.y + freshAvg.y),
+                         0.5f * (keptAvg.z + freshAvg.z), 0.5f * (keptAvg.d + freshAvg.d)},
+                        {mix(keptAvg.x, keptVar.x, freshAvg.x, freshVar.x),
+                         mix(keptAvg.y, keptVar.y, freshAvg.y, freshVar.y),
+                         mix(keptAvg.z, keptVar.z, freshAvg.z, freshVar.z),
+                         mix(keptAvg.d, keptVar.d, freshAvg.d, freshVar.d)},
+                        compactMargin);
+    }
+
+    // Below the cutoff first, then ties, marking the replaced slots with -inf
+    int replaced = 0;
+    for (int pass = 0; pass < 2 && replaced < fresh; pass++) {
+        for (int i = 0; i < n && replaced < fresh; i++) {
+            if (pass == 0 ? logWeights[i] < cutoff : logWeights[i] == cutoff) {
+                if (storage == ParticleStorage::Fixed16) {
+                    compact.set(i, freshSet.get(replaced));
+                } else {
+                    particles.set(i, freshSet.get(replaced));
+                }
+                logWeights[i] = -INFINITY;
+                replaced++;
+            }
+        }
+    }
+    // The fresh particles share the fraction of the total weight they replace
+    double kept = 0.0;
+    for (int i = 0; i < n; i++) {
+        kept += std::exp(static_cast<double>(logWeights[i] - largest));
+    }
+    const double share = static_cast<double>(replaced) / n;
+    const float freshLog = largest + static_cast<float>(std::log(share / (1.0 - share) * kept / replaced));
+    for (int i = 0; i < n; i++) {
+        if (logWeights[i] == -INFINITY) {
+            logWeights[i] = freshLog;
+        }
+    }
+    FILTER_STAT(stats.reinjections++);
+    FILTER_STAT(stats.reinjectedParticles += replaced);
+    return true;
+}
+
+void Filter::resample(float sum_w, particle jitterVar) {
+    FILTER_STAT(PhaseTimer timer(stats.resampleNs));
+    // Normalize weights, the parallel resampler normalizes its own prefix sum
+    const bool parallel = resamplePool && storage == ParticleStorage::Float;
+    const int n = N;
+    if (!parallel || adaptive) {
+        for (int i=0;i<n;i++){
+            weights[i] /= sum_w;
+        }
+    }
+
+    const int nOut = adaptive ? kldSampleCount() : n;
+
+    const float sigmaX = std::sqrt(jitterVar.x) / 10;
+    const float sigmaY = std::sqrt(jitterVar.y) / 10;
+    const float sigmaZ = std::sqrt(jitterVar.z) / 10;
+    const float sigmaD = MAX(1e-7f, std::sqrt(jitterVar.d) / 10.0f);
 
     // Resample particles using low-variance resampling
-    std::vector<particle> newParticles;
-    float wTarget = 1.0f / particles.size();
-    float r = static_cast<float>(rand()) / RAND_MAX * wTarget;
-    float c = weights[0];
-    int i = 0;
-    int oldi = 0;
-    int repcounter = 0;
-    for (int m = 0; m < particles.size(); m++) {
-        float U = r + m * wTarget;
-        while (U > c) {
-            i = (i + 1) % particles.size();
-            c += weights[i];
+    // Write into the back buffer and swap, no allocation or copy of the particle set
+    float r = rng.uniform() * (1.0f / nOut);
+    int longestRun = 0;
+    int duplicates;
+    if (storage == ParticleStorage::Fixed16) {
+        // encode the new cloud around the current weighted estimate, widened by the jitter
+        particle avg, var;
+        computeMoments(compact, weights.data(), &avg, &var);
+        var = {var.x + sigmaX * sigmaX, var.y + sigmaY * sigmaY, var.z + sigmaZ * sigmaZ, var.d + sigmaD * sigmaD};
+        shared.next.delay = modelAntennaDelay;
+        shared.next.setScale(avg, var, compactMargin);
+        rng.fillGaussian(scratch.data(), modelAntennaDelay ? 4 * nOut : 3 * nOut, 0.0f, 1.0f);
+        duplicates = resampleSystematic(compact, weights.data(), nOut, r, scratch.data(),
+                                        {sigmaX, sigmaY, sigmaZ, sigmaD}, modelAntennaDelay, shared.next,
+                                        &estimateAvg, &estimateVar, &longestRun);
+        // copied rather than swapped, so the filter keeps its arena memory and next stays on the heap
+        compact.assign(shared.next);
+    } else if (parallel) {
+        uint64_t streamSeed = (static_cast<uint64_t>(rng.next()) << 32) | rng.next();
+        duplicates = resampleSystematicParallel(particles, weights.data(), cumulativeWeights.data(), nOut, r,
+                                                streamSeed, scratch.data(), {sigmaX, sigmaY, sigmaZ, sigmaD},
+                                                modelAntennaDelay, nextParticles, &estimateAvg, &estimateVar,
+                                                *resamplePool, &longestRun);
+        particles.swap(nextParticles);
+    } else {
+        // Draw the jitter for the whole resampled set up front, scaled per particle in the kernel
+        rng.fillGaussian(scratch.data(), modelAntennaDelay ? 4 * nOut : 3 * nOut, 0.0f, 1.0f);
+        duplicates = resampleSystematic(particles, weights.data(), nOut, r, scratch.data(),
+                                        {sigmaX, sigmaY, sigmaZ, sigmaD}, modelAntennaDelay, nextParticles,
+                                        &estimateAvg, &estimateVar, &longestRun);
+        particles.swap(nextParticles);
+    }
+    setActiveSize(nOut);
+    for (int m = 0; m < nOut; m++) {
+        logWeights[m] = 0.0f;
+    }
+    FILTER_STAT(stats.resamples++);
+    FILTER_STAT(stats.duplicates += duplicates);
+    FILTER_STAT(stats.longestRun = MAX(stats.longestRun, longestRun));
+}
+
+
+// Snapshot layout, version 1, every field little-endian:
+//   "PFSN", uint32 version, uint32 flags (snapshot* below)
+//   int32 N, minN, maxN, float kldBinSize, kldEpsilon, resampleThreshold, uint32 precision, resampleThreads
+//   float estimateAvg x/y/z/d, estimateVar x/y/z/d
+//   uint32 rng state[4], uint32 hasSpare, float spare
+//   per axis x, y, z and d when the delay is modelled:
+//     N floats, or when quantized a float step then N int16 offsets from estimateAvg
+//   N float log weights, omitted when they are all zero (right after an init or a resample)
+static const unsigned char snapshotMagic[4] = {'P', 'F', 'S', 'N'};
+static const uint32_t snapshotVersion = 1;
+static const uint32_t snapshotQuantized = 1;
+static const uint32_t snapshotDelay = 2;
+static const uint32_t snapshotInitialized = 4;
+static const uint32_t snapshotAdaptive = 8;
+static const uint32_t snapshotUniformWeights = 16;
+
+std::vector<uint8_t> Filter::serialize(bool quantized) const {
+    const int n = N;
+    // snapshots hold floats whatever the storage, so they restore into either mode
+    ParticleSet decoded;
+    if (storage == ParticleStorage::Fixed16) {
+        decoded.delay = modelAntennaDelay;
+        decoded.resize(n);
+        for (int i = 0; i < n; i++) {
+            decoded.set(i, compact.get(i));
         }
-        float minVariance  = 1e-1f;
-        if(i == oldi){
-            minVariance *=repcounter*1.05;
-            repcounter++;
-        } else{
-            repcounter = 1;
+    }
+    const ParticleSet& cloud = storage == ParticleStorage::Fixed16 ? decoded : particles;
+    bool uniform = true;
+    for (int i = 0; i < n && uniform; i++) {
+        uniform = logWeights[i] == 0.0f;
+    }
+    uint32_t flags = (quantized ? snapshotQuantized : 0) | (modelAntennaDelay ? snapshotDelay : 0) |
+                     (isInitialized ? snapshotInitialized : 0) | (adaptive ? snapshotAdaptive : 0) |
+                     (uniform ? snapshotUniformWeights : 0);
+    const int axes = modelAntennaDelay ? 4 : 3;
+
+    std::vector<uint8_t> bytes;
+    bytes.reserve(100 + axes * (quantized ? 4 + 2 * n : 4 * n) + (uniform ? 0 : 4 * n));
+    ByteWriter out(bytes);
+    out.bytes(snapshotMagic, 4);
+    out.u32(snapshotVersion);
+    out.u32(flags);
+    out.u32(n);
+    out.u32(minN);
+    out.u32(maxN);
+    out.f32(kldBinSize);
+    out.f32(kldEpsilon);
+    out.f32(resampleThreshold);
+    out.u32(static_cast<uint32_t>(precision));
+    out.u32(resampleThreads);
+    const float avg[4] = {estimateAvg.x, estimateAvg.y, estimateAvg.z, estimateAvg.d};
+    const float var[4] = {estimateVar.x, estimateVar.y, estimateVar.z, estimateVar.d};
+    out.f32s(avg, 4);
+    out.f32s(var, 4);
+    Rng::State state = rng.getState();
+    for (uint32_t word : state.s) {
+        out.u32(word);
+    }
+    out.u32(state.hasSpare);
+    out.f32(state.spare);
+
+    const AlignedArray* arrays[4] = {&cloud.x, &cloud.y, &cloud.z, &cloud.d};
+    for (int a = 0; a < axes; a++) {
+        const float* v = arrays[a]->data();
+        if (!quantized) {
+            out.f32s(v, n);
+            continue;
+        }
+        float largest = 0.0f;
+        for (int i = 0; i < n; i++) {
+            largest = MAX(largest, std::fabs(v[i] - avg[a]));
         }
-        oldi = i;
-        // Resample particle with added Gaussian noise
-        particle newParticle = particles[i];
-        newParticle.x += randomGaussian(0, MAX(minVariance, repcounter*::sqrt(anchorVar.x)/10));
-        newParticle.y += randomGaussian(0, MAX(minVariance, repcounter*::sqrt(anchorVar.y)/10));
-        newParticle.z += randomGaussian(0, MAX(minVariance, repcounter*::sqrt(anchorVar.z)/10));
-        newParticle.d = MAX(0,newParticle.d+randomGaussian(0, MAX(1e-7f, std::sqrt(anchorVar.d) / 10.0)));
-        newParticles.push_back(newParticle);
+        const float step = largest > 0.0f ? largest / 32767.0f : 1.0f;
+        const float inverse = 1.0f / step;
+        out.f32(step);
+        for (int i = 0; i < n; i++) {
+            long q = std::lround((v[i] - avg[a]) * inverse);
+            out.u16(static_cast<uint16_t>(static_cast<int16_t>(MIN(MAX(q, -32767L), 32767L))));
+        }
+    }
+    if (!uniform) {
+        out.f32s(logWeights.data(), n);
     }
-    particles = newParticles;
-    updateEstimates();
+    return bytes;
 }
 
+void Filter::deserialize(const std::vector<uint8_t>& bytes) {
+    // Read and check the whole header before touching the filter
+    ByteReader in(bytes.data(), bytes.size());
+    if (std::memcmp(in.take(4), snapshotMagic, 4) != 0) {
+        throw std::invalid_argument("Not a filter snapshot");
+    }
+    if (in.u32() != snapshotVersion) {
+        throw std::invalid_argument("Unsupported filter snapshot version");
+    }
+    const uint32_t flags = in.u32();
+    const int n = static_cast<int32_t>(in.u32());
+    const int newMinN = static_cast<int32_t>(in.u32());
+    const int newMaxN = static_cast<int32_t>(in.u32());
+    const float binSize = in.f32();
+    const float epsilon = in.f32();
+    const float threshold = in.f32();
+    const uint32_t newPrecision = in.u32();
+    const int threads = static_cast<int32_t>(in.u32());
+    float avg[4], var[4];
+    in.f32s(avg, 4);
+    in.f32s(var, 4);
+    Rng::State state;
+    for (uint32_t& word : state.s) {
+        word = in.u32();
+    }
+    state.hasSpare = in.u32() != 0;
+    state.spare = in.f32();
+
+    const bool quantized = flags & snapshotQuantized;
+    const bool delay = flags & snapshotDelay;
+    const bool newAdaptive = flags & snapshotAdaptive;
+    const bool uniform = flags & snapshotUniformWeights;
+    const int axes = delay ? 4 : 3;
+    if (flags >= 32 || n < 1 || threads < 0 || newPrecision > static_cast<uint32_t>(Precision::Fast) ||
+        (newAdaptive && (newMinN < 1 || n < newMinN || newMaxN < n || !(binSize > 0) || !(epsilon > 0))) ||
+        (state.s[0] | state.s[1] | state.s[2] | state.s[3]) == 0) {
+        throw std::invalid_argument("Filter snapshot holds invalid settings");
+    }
+    const uint64_t payload = uint64_t(axes) * (quantized ? 4 + 2 * uint64_t(n) : 4 * uint64_t(n)) +
+                             (uniform ? 0 : 4 * uint64_t(n));
+    if (in.remaining() != payload) {
+        throw std::invalid_argument("Filter snapshot size does not match its particle count");
+    }
+
+    // the d array only exists when the delay is modelled
+    if (delay != modelAntennaDelay) {
+        particles = ParticleSet();
+        nextParticles = ParticleSet();
+        compact = CompactParticleSet();
+        setArena(arena);
+    }
+    modelAntennaDelay = delay;
+    particles.delay = delay;
+    nextParticles.delay = delay;
+    compact.delay = delay;
+    this->N = n;
+    this->minN = newMinN;
+    this->maxN = newMaxN;
+    if (newAdaptive) {
+        setAdaptive(true, newMinN, newMaxN, binSize, epsilon);
+    } else {
+        this->adaptive = false;
+        this->kldBinSize = binSize;
+        this->kldEpsilon = epsilon;
+        allocateBuffers(n);
+    }
+    if (threads != resampleThreads) {
+        setResampleThreads(threads);
+    }
+    resampleThreshold = threshold;
+    precision = static_cast<Precision>(newPrecision);
+    estimateAvg = {avg[0], avg[1], avg[2], avg[3]};
+    estimateVar = {var[0], var[1], var[2], var[3]};
+    rng.setState(state);
+    isInitialized = flags & snapshotInitialized;
+    // remembered ranges and evidence averages belong to the run before the restore
+    historyCount = 0;
+    proposalPending = false;
+    evidenceFast = 0.0;
+    evidenceSlow = 0.0;
+
+    ParticleSet decoded;
+    decoded.delay = delay;
+    if (storage == ParticleStorage::Fixed16) {
+        decoded.resize(n);
+    }
+    ParticleSet& cloud = storage == ParticleStorage::Fixed16 ? decoded : particles;
+    AlignedArray* arrays[4] = {&cloud.x, &cloud.y, &cloud.z, &cloud.d};
+    for (int a = 0; a < axes; a++) {
+        float* v = arrays[a]->data();
+        if (!quantized) {
+            in.f32s(v, n);
+            continue;
+        }
+        const float step = in.f32();
+        for (int i = 0; i < n; i++) {
+            v[i] = avg[a] + static_cast<int16_t>(in.u16()) * step;
+        }
+    }
+    if (storage == ParticleStorage::Fixed16) {
+        compact.setScale(estimateAvg, estimateVar, compactMargin);
+        for (int i = 0; i < n; i++) {
+            compact.set(i, decoded.get(i));
+        }
+    }
+    if (uniform) {
+        for (int i = 0; i < n; i++) {
+            logWeights[i] = 0.0f;
+        }
+    } else {
+        in.f32s(logWeights.data(), n);
+    }
+}
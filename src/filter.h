@@ -1,44 +1,217 @@
 #ifndef FILTER_H
 #define FILTER_H
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include <stdexcept>
+#include "arena.h"
+#include "multilateration.h"
+#include "particles.h"
+#include "precision.h"
+#include "rng.h"
+#include "stats.h"
+#include "threadPool.h"
+#include "trace.h"
+#include "telemetry.h"
 
-// Define the particle particle structure
-struct particle {
-    float x, y, z, d;
-};
+struct CloudUpdate;
 
 // Define the Filter class
 class Filter {
+    friend struct CloudUpdate;
+
 private:
-    std::vector<particle> particles;
+    ParticleSet particles;
+    // Persistent work buffers, sized with the particle count
+    ParticleSet nextParticles;
+    AlignedArray weights;
+    AlignedArray scratch;
+    // Log-domain weights persisted between updates, normalized to a mean weight of 1
+    AlignedArray logWeights;
+    float resampleThreshold = 0.5f;
+    FilterStats stats;
+    Precision precision = defaultPrecision;
     int N;
     float w_sum;
-    particle estimateAvg;
-    particle estimateVar;
+    particle estimateAvg = {0, 0, 0, 0};
+    particle estimateVar = {0, 0, 0, 0};
     bool isInitialized = false;
     bool modelAntennaDelay = true;
+    Rng rng;
+    AlignedArray packedPositions;
+    // KLD-adaptive particle count
+    bool adaptive = false;
+    int minN = 0;
+    int maxN = 0;
+    float kldBinSize = 0.5f;
+    float kldEpsilon = 0.05f;
+    int kldTableBits = 0;
+    static constexpr uint64_t kldEmptyBin = ~0ULL;
+    std::vector<uint64_t> kldBins;
+    std::vector<int> kldUsedSlots;
+    // Parallel resampling, shared by copies of the filter; null resamples serially
+    int resampleThreads = 1;
+    std::shared_ptr<ThreadPool> resamplePool;
+    AlignedArray cumulativeWeights;
+    // Optional measurement trace, shared by copies of the filter
+    std::shared_ptr<TraceWriter> trace;
+    uint32_t traceNode = 0;
+    // Optional estimate telemetry, pushed at the end of every update by a TelemetryScope
+    std::shared_ptr<TelemetryRing> telemetry;
+    uint32_t telemetryNode = 0;
+    class TelemetryScope;
+    // With Fixed16 storage the particles live in compact and the float sets, weights and scratch stay empty
+    // between calls; an update borrows them from buffers shared by the filters of its thread
+    ParticleStorage storage = ParticleStorage::Float;
+    CompactParticleSet compact;
+    // Arena of every buffer above (null: the heap), kept to draw the buffers of a new layout from it
+    std::shared_ptr<ParticleArena> arena;
+    particle particleAt(int i) const { return storage == ParticleStorage::Float ? particles.get(i) : compact.get(i); }
+    // Ring of the last ranges for the multilateration init, and their oldest-first copy for the solver
+    InitMode initMode = InitMode::Sphere;
+    float proposalInflation = 4.0f;
+    int historyCount = 0;
+    int historyNext = 0;
+    std::vector<float> historyMeasurements;
+    std::vector<particle> historyAvgs;
+    std::vector<particle> historyVars;
+    std::vector<float> fixMeasurements;
+    std::vector<particle> fixAvgs;
+    std::vector<particle> fixVars;
+    // Set by a sphere init in multilateration mode, until the ranges can fix a position
+    bool proposalPending = false;
+    void rememberRanges(const float* measurements, const particle* anchorAvgs, const particle* anchorVars, int k);
+    bool fixFromHistory(RangeFix* fix);
+    bool initFromHistory();
+    void finishInit();
+    // Collapse recovery: temper the likelihood and re-inject part of the cloud rather than reinitialize
+    bool collapseRecovery = false;
+    float reinjectMinFraction = 0.1f;
+    float reinjectMaxFraction = 0.5f;
+    float minTempering = 0.01f;
+    // effective sample size, as a fraction of N, that a tempered update must keep
+    static constexpr float temperingESS = 0.1f;
+    // fast and slow running averages of the evidence; the re-injected fraction is 1 - fast / slow, clamped
+    double evidenceFast = 0.0;
+    double evidenceSlow = 0.0;
+    bool recoverCollapse(const float* measurements, const particle* anchorAvgs, const particle* anchorVars, int k);
+    void allocateBuffers(int capacity);
+    void setActiveSize(int n);
+    int kldSampleCount();
     void initParticles(float measurement,float P_NLoss, particle anchorAvg, particle anchorVar);
     void updateEstimates();
+    void updateBatch(const float* measurements, float P_NLoss, const particle* anchorAvgs, const particle* anchorVars,
+                     int k);
+    // Hooks of CloudUpdate, which runs updateBatch
+    int cloudSize() const { return N; }
+    float weigh(const float* measurements, const particle* anchorAvgs, const particle* anchorVars, int k,
+                float* maxLogWeight, float* sumSquares);
+    void trackEvidence(float logEvidence);
+    void reinitialize(const float* measurements, float P_NLoss, const particle* anchorAvgs,
+                      const particle* anchorVars, int k);
+    void trackESS(float ess);
+    // Normalize the weights, low-variance resample with jitter scaled by jitterVar, update the estimates on the way
+    void resample(float sum_w, particle jitterVar);
+    // Deep copies only go through clone()
+    Filter(const Filter& other) = default;
 
 public:
     // Constructor to initialize the vector with N elements
-    Filter(int N, bool modelAntennaDelay = true);
+    Filter(int N, bool modelAntennaDelay = true, unsigned int seed = Rng::defaultSeed);
+    // Same, with the particle storage and work buffers drawn from arena
+    Filter(int N, bool modelAntennaDelay, unsigned int seed, std::shared_ptr<ParticleArena> arena);
+    // Filters are moved, which only hands over their buffers; copies are explicit
+    Filter(Filter&& other) = default;
+    Filter& operator=(Filter&& other) = default;
+    Filter& operator=(const Filter& other) = delete;
+    // Independent copy with the same particles, settings and random stream, in the same arena. It shares the
+    // trace recorder and resample pool like the original but not its telemetry ring, which has one producer.
+    Filter clone() const;
+    // Move every buffer to memory drawn from arena (null: the heap), keeping the particles
+    void setArena(std::shared_ptr<ParticleArena> arena);
 
     // Retrieve an element by index
     particle get(int i) const;
     void set(int i, particle d);
+    // Current particle count; in adaptive mode it changes on every resample
     int getN() const;
+    // Fixed particle count, this also leaves adaptive mode
     void setN(int N);
+    // Let each resample pick N by KLD-sampling over a binSize grid (metres), between minN and maxN.
+    // epsilon bounds the KL error of the sampled distribution; initialization starts at maxN.
+    void setAdaptive(bool enabled, int minN, int maxN, float binSize = 0.5f, float epsilon = 0.05f);
+    bool isAdaptive() const;
+    // False until the first update, and again after setN
+    bool hasEstimate() const;
+    // Resample when the effective sample size drops below fraction * N; above 1 resamples on every update
+    void setResampleThreshold(float fraction);
+    float getResampleThreshold() const;
+    // Resample on a pool of this many threads (0: every hardware thread, 1: the serial resampler).
+    // The parallel resampler scales the jitter like the serial one, including the unfloored first output,
+    // but draws its noise from per-segment streams: the values differ from the serial resampler's, and do
+    // not depend on the thread count.
+    void setResampleThreads(int threads);
+    int getResampleThreads() const;
+    // Exact or fast math in the weighting and initialization loops, see precision.h
+    void setPrecision(Precision precision);
+    Precision getPrecision() const;
     particle getEstimateAvg() const;
     particle getEstimateVar() const;
+    // Direct read access to the SoA storage; pointers are invalidated by the next update or setN.
+    // Empty with Fixed16 storage, use get() or packPositions() there.
+    const ParticleSet& getParticles() const;
+    // Float keeps 16 bytes per particle (12 without the delay), plus its own update buffers.
+    // Fixed16 keeps 16-bit offsets from the estimate, scaled to CompactParticleSet::sigmas standard deviations,
+    // and the log weights (10 or 12 bytes), and shares the update buffers with every Fixed16 filter of the
+    // thread; the kernels decode it on the fly. Fixed16 always resamples serially. Switching converts the cloud.
+    void setStorage(ParticleStorage storage);
+    ParticleStorage getStorage() const;
+    // Multilateration keeps the last history ranges and (re)initializes from their least squares fix: the cloud
+    // is drawn from a Gaussian around it, with inflation times its covariance, and starts with equal weights.
+    // Until the ranges fix a position (enough of them, from anchors that are not coplanar, with a consistent
+    // chi2) the sphere init is used, and the cloud is replaced by the proposal as soon as they do.
+    // The oldest ranges are dropped one by one when they disagree with the newer ones.
+    void setInitMode(InitMode mode, int history = 8, float inflation = 4.0f);
+    InitMode getInitMode() const;
+    // When the evidence of an update collapses, keep the cloud instead of reinitializing it: its likelihood is
+    // tempered by the largest exponent in [minTempering, 1] (a variance inflation of up to 1 / minTempering)
+    // that keeps a tenth of the effective sample size, then its lightest particles are replaced by fresh ones
+    // from the init mode. The fresh fraction, between minFraction and maxFraction, grows with the drop of the
+    // short-run evidence below the long-run one. Disabled, a collapse reinitializes the whole cloud.
+    void setCollapseRecovery(bool enabled, float minFraction = 0.1f, float maxFraction = 0.5f,
+                             float minTempering = 0.01f);
+    bool getCollapseRecovery() const;
+    // Interleave x,y,z of every stride-th particle into an owned buffer, returns the particle count
+    int packPositions(int stride);
+    const float* getPackedPositions() const;
     void estimateState(float measurement, float P_NLoss, particle anchorAvg, particle anchorVar);
+    // Update against several anchors at once: one weighting sweep and a single resample
+    void estimateStateBatch(const std::vector<float>& measurements, const std::vector<particle>& anchorAvgs,
+                            const std::vector<particle>& anchorVars);
+    // Per-phase timings and counters accumulated since construction or the last resetStats()
+    FilterStats getStats() const;
+    void resetStats();
+    // Restart the random stream, e.g. to replay a run
+    void seed(unsigned int seed);
+    // Append every estimateState / estimateStateBatch call to recorder as node, null stops recording.
+    // Replaying the trace through a filter built with the same N, delay flag and seed reproduces the run.
+    void setTraceRecorder(std::shared_ptr<TraceWriter> recorder, uint32_t node = 0);
+    // Push the estimate, its timestamp and the phase timings of every update to ring as node, null stops.
+    // The ring has a single producer: only the thread that updates this filter may push to it.
+    void setTelemetry(std::shared_ptr<TelemetryRing> ring, uint32_t node = 0);
+    // Snapshot of the whole filter: particles and log weights, N and the adaptive settings, the
+    // delay, precision and threshold options, the estimates and the random stream, so a restored
+    // filter continues exactly like this one. Stats and the trace recorder are not included.
+    // Quantized snapshots store positions as 16-bit offsets from the estimate, in steps of
+    // 1/32767 of the largest offset on each axis. See filter.cpp for the layout.
+    std::vector<uint8_t> serialize(bool quantized = false) const;
+    // Restore a snapshot, throws std::invalid_argument and leaves the filter unchanged if it is malformed
+    void deserialize(const std::vector<uint8_t>& bytes);
 
 };
 
 // utility functions
 float dist(particle p1, particle p2);
-float randomGaussian(float mean, float stddev);
 
 #endif // FILTER_H 
@@ -0,0 +1,89 @@
+#include "filterBank.h"
+
+FilterBank::FilterBank(int nodes, int N, bool modelAntennaDelay, unsigned int seed, int threads)
+    : arena(std::make_shared<ParticleArena>()), pool(new ThreadPool(threads)) {
+    filters.reserve(nodes);
+    for (int i = 0; i < nodes; i++) {
+        filters.emplace_back(N, modelAntennaDelay, seed + i, arena);
+    }
+    snapshotAvg.resize(nodes);
+    snapshotVar.resize(nodes);
+    jobsPerNode.resize(nodes);
+}
+
+int FilterBank::size() const {
+    return filters.size();
+}
+
+int FilterBank::threads() const {
+    return pool->size() > 0 ? pool->size() : 1;
+}
+
+Filter& FilterBank::node(int i) {
+    if (i < 0 || i >= size()) {
+        throw std::out_of_range("Node index out of range");
+    }
+    return filters[i];
+}
+
+const Filter& FilterBank::node(int i) const {
+    if (i < 0 || i >= size()) {
+        throw std::out_of_range("Node index out of range");
+    }
+    return filters[i];
+}
+
+const ParticleArena& FilterBank::getArena() const {
+    return *arena;
+}
+
+particle FilterBank::getEstimateAvg(int i) const {
+    return node(i).getEstimateAvg();
+}
+
+particle FilterBank::getEstimateVar(int i) const {
+    return node(i).getEstimateVar();
+}
+
+void FilterBank::setTelemetry(TelemetryDrain& drain, size_t capacity) {
+    for (int i = 0; i < size(); i++) {
+        filters[i].setTelemetry(drain.addRing(capacity), i);
+    }
+}
+
+void FilterBank::runRound(const std::vector<BankJob>& jobs) {
+    for (const BankJob& job : jobs) {
+        if (job.node < 0 || job.node >= size() || job.neighbour < -1 || job.neighbour >= size()) {
+            throw std::out_of_range("Job refers to a node outside the bank");
+        }
+    }
+
+    // Freeze every estimate before any update so neighbours see the previous round
+    for (int i = 0; i < size(); i++) {
+        snapshotAvg[i] = filters[i].getEstimateAvg();
+        snapshotVar[i] = filters[i].getEstimateVar();
+        jobsPerNode[i].clear();
+    }
+    for (int j = 0; j < (int)jobs.size(); j++) {
+        jobsPerNode[jobs[j].node].push_back(j);
+    }
+
+    std::vector<int> busyNodes;
+    for (int i = 0; i < size(); i++) {
+        if (!jobsPerNode[i].empty()) {
+            busyNodes.push_back(i);
+        }
+    }
+
+    pool->parallelFor(busyNodes.size(), [&](int t) {
+        int i = busyNodes[t];
+        for (int j : jobsPerNode[i]) {
+            const BankJob& job = jobs[j];
+            if (job.neighbour >= 0) {
+                filters[i].estimateState(job.measurement, 0, snapshotAvg[job.neighbour], snapshotVar[job.neighbour]);
+            } else {
+                filters[i].estimateState(job.measurement, 0, job.anchorAvg, job.anchorVar);
+            }
+        }
+    });
+}
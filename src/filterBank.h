@@ -0,0 +1,51 @@
+#ifndef FILTERBANK_H
+#define FILTERBANK_H
+
+#include <memory>
+#include <vector>
+#include "filter.h"
+#include "threadPool.h"
+
+// One ranging update for a node of the bank
+struct BankJob {
+    int node;
+    float measurement;
+    // Index of the node the range was measured to, or -1 for a fixed anchor given by anchorAvg/anchorVar
+    int neighbour = -1;
+    particle anchorAvg = {0, 0, 0, 0};
+    particle anchorVar = {0, 0, 0, 0};
+};
+
+// Owns the filters of many nodes and runs a round of updates across cores.
+// Neighbour estimates are snapshotted when the round starts (Jacobi style), and the jobs
+// of one node run in submission order, so the results do not depend on scheduling.
+class FilterBank {
+private:
+    // particle storage of every node, drawn from one arena
+    std::shared_ptr<ParticleArena> arena;
+    std::vector<Filter> filters;
+    std::vector<particle> snapshotAvg;
+    std::vector<particle> snapshotVar;
+    std::vector<std::vector<int>> jobsPerNode;
+    std::unique_ptr<ThreadPool> pool;
+
+public:
+    // Node i is seeded with seed + i; threads = 0 uses every hardware thread
+    FilterBank(int nodes, int N, bool modelAntennaDelay = true, unsigned int seed = Rng::defaultSeed, int threads = 0);
+
+    int size() const;
+    // Updates runRound can run at once, at least 1
+    int threads() const;
+    Filter& node(int i);
+    const Filter& node(int i) const;
+    const ParticleArena& getArena() const;
+    particle getEstimateAvg(int i) const;
+    particle getEstimateVar(int i) const;
+
+    void runRound(const std::vector<BankJob>& jobs);
+
+    // Gives every node its own ring of drain, pushed to as node i from whichever worker runs it
+    void setTelemetry(TelemetryDrain& drain, size_t capacity = 4096);
+};
+
+#endif // FILTERBANK_H
@@ -0,0 +1,733 @@
+#include "kernels.h"
+#include "filter.h"
+#include "rng.h"
+#include "threadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+static const float regFactor = 1e-6f;
+
+// Exponent of the likelihood of one particle for one measurement
+static inline float logLikelihood(particle p, float measurement, particle anchorAvg, particle anchorVar,
+                                  bool modelAntennaDelay) {
+    float distance = dist(p, anchorAvg);
+
+    // Compute error, including delay error component if modeled
+    float ourDelayErrorComponent = modelAntennaDelay ? p.d * measurement : 0.0f;
+    float anchorDelayErrorComponent = modelAntennaDelay ? anchorAvg.d * measurement : 0.0f;
+    float rerror = measurement - (distance + ourDelayErrorComponent + anchorDelayErrorComponent);
+
+    float dx = p.x - anchorAvg.x;
+    float dy = p.y - anchorAvg.y;
+    float dz = p.z - anchorAvg.z;
+
+    // Compute the total 3D distance
+    float norm = std::sqrt(dx * dx + dy * dy + dz * dz);
+    // Avoid division by zero for zero distance
+    if (norm == 0.0f) norm = 1e-6f;
+    // Normalize the vector difference
+    float nx = dx / norm;
+    float ny = dy / norm;
+    float nz = dz / norm;
+
+    float e_x = nx * rerror;
+    float e_y = ny * rerror;
+    float e_z = nz * rerror;
+    // Compute the likelihood using per-axis variances
+    return -0.5f * (
+        (e_x * e_x) / (anchorVar.x + regFactor) +
+        (e_y * e_y) / (anchorVar.y + regFactor) +
+        (e_z * e_z) / (anchorVar.z + regFactor)
+    );
+}
+
+float computeWeightsScalar(const ParticleSet& particles, float measurement, particle anchorAvg,
+                           particle anchorVar, bool modelAntennaDelay, float* weights) {
+    float sum_w = 0.0f;
+    for (int i = 0; i < particles.size(); i++) {
+        float likelihood = std::exp(logLikelihood(particles.get(i), measurement, anchorAvg, anchorVar, modelAntennaDelay));
+        weights[i] = likelihood;
+        sum_w += likelihood;
+    }
+    return sum_w;
+}
+
+float computeWeightsBatchScalar(const ParticleSet& particles, const float* measurements, const particle* anchorAvgs,
+                                const particle* anchorVars, int k, bool modelAntennaDelay, float* weights) {
+    float sum_w = 0.0f;
+    for (int i = 0; i < particles.size(); i++) {
+        particle p = particles.get(i);
+        float exponent = 0.0f;
+        for (int j = 0; j < k; j++) {
+            exponent += logLikelihood(p, measurements[j], anchorAvgs[j], anchorVars[j], modelAntennaDelay);
+        }
+        float likelihood = std::exp(exponent);
+        weights[i] = likelihood;
+        sum_w += likelihood;
+    }
+    return sum_w;
+}
+
+#if FILTER_SIMD_WIDTH > 0
+// Per-measurement invariants, hoisted out of the particle loop
+struct AnchorTerms {
+    float m, ax, ay, az, delayOffset, ivx, ivy, ivz;
+};
+
+static AnchorTerms anchorTerms(float measurement, particle anchorAvg, particle anchorVar) {
+    return {measurement, anchorAvg.x, anchorAvg.y, anchorAvg.z, anchorAvg.d * measurement,
+            1.0f / (anchorVar.x + regFactor), 1.0f / (anchorVar.y + regFactor), 1.0f / (anchorVar.z + regFactor)};
+}
+
+// Exponent for one vector of particles; (e_x^2/vx + ...) is folded into rerror^2/norm^2 * (dx^2/vx + ...)
+template <class Math, bool ModelDelay>
+static inline simd::vfloat logLikelihoodBlock(simd::vfloat x, simd::vfloat y, simd::vfloat z, simd::vfloat d,
+                                              const AnchorTerms& a) {
+    using namespace simd;
+    vfloat m = set1(a.m);
+    vfloat dx = sub(x, set1(a.ax));
+    vfloat dy = sub(y, set1(a.ay));
+    vfloat dz = sub(z, set1(a.az));
+    vfloat dx2 = mul(dx, dx);
+    vfloat dy2 = mul(dy, dy);
+    vfloat dz2 = mul(dz, dz);
+    vfloat norm2 = add(add(dx2, dy2), dz2);
+    // a particle on the anchor has q = 0 below, the clamp only keeps the root and inverse finite
+    norm2 = select(cmpeq(norm2, set1(0.0f)), set1(1e-12f), norm2);
+    vfloat norm, inverseNorm2;
+    Math::rootAndInverse(norm2, &norm, &inverseNorm2);
+
+    vfloat rerror = sub(m, norm);
+    if (ModelDelay) {
+        rerror = sub(rerror, add(mul(d, m), set1(a.delayOffset)));
+    }
+
+    vfloat q = add(add(mul(dx2, set1(a.ivx)), mul(dy2, set1(a.ivy))), mul(dz2, set1(a.ivz)));
+    return mul(set1(-0.5f), mul(mul(mul(rerror, rerror), inverseNorm2), q));
+}
+
+// Vector loads of the particles i .. i + width - 1, from float storage or decoded from fixed point.
+// d is only loaded with ModelDelay, its array is empty otherwise.
+struct FloatBlocks {
+    const float *x, *y, *z, *d;
+
+    explicit FloatBlocks(const ParticleSet& particles)
+        : x(particles.x.data()), y(particles.y.data()), z(particles.z.data()), d(particles.d.data()) {}
+
+    template <bool ModelDelay>
+    void load(int i, simd::vfloat* px, simd::vfloat* py, simd::vfloat* pz, simd::vfloat* pd) const {
+        *px = simd::load(x + i);
+        *py = simd::load(y + i);
+        *pz = simd::load(z + i);
+        *pd = ModelDelay ? simd::load(d + i) : simd::set1(0.0f);
+    }
+};
+
+struct FixedBlocks {
+    const int16_t *x, *y, *z, *d;
+    simd::vfloat ox, oy, oz, od, sx, sy, sz, sd;
+
+    explicit FixedBlocks(const CompactParticleSet& particles)
+        : x(particles.x.data()), y(particles.y.data()), z(particles.z.data()), d(particles.d.data()),
+          ox(simd::set1(particles.origin.x)), oy(simd::set1(particles.origin.y)),
+          oz(simd::set1(particles.origin.z)), od(simd::set1(particles.origin.d)),
+          sx(simd::set1(particles.step.x)), sy(simd::set1(particles.step.y)), sz(simd::set1(particles.step.z)),
+          sd(simd::set1(particles.step.d)) {}
+
+    template <bool ModelDelay>
+    void load(int i, simd::vfloat* px, simd::vfloat* py, simd::vfloat* pz, simd::vfloat* pd) const {
+        using namespace simd;
+        *px = add(ox, mul(sx, loadInt16(x + i)));
+        *py = add(oy, mul(sy, loadInt16(y + i)));
+        *pz = add(oz, mul(sz, loadInt16(z + i)));
+        *pd = ModelDelay ? add(od, mul(sd, loadInt16(d + i))) : set1(0.0f);
+    }
+};
+
+// One sweep over the n particles for k measurements: out = in + sum of exponents (in may be null for 0).
+// With exponentiate the result is exp'd and the sum is returned, otherwise the maximum is returned.
+// Each block is loaded once for all k measurements.
+template <class Math, bool ModelDelay, class Blocks>
+static float weightSweep(const Blocks& blocks, int n, const AnchorTerms* terms, int k, const float* in, float* out,
+                         bool exponentiate) {
+    using namespace simd;
+    alignas(AlignedArray::alignment) float tail[width];
+
+    vfloat acc = set1(exponentiate ? 0.0f : -INFINITY);
+    // The arrays are padded to a full vector, so the tail is one more block
+    for (int i = 0; i < n; i += width) {
+        const int lanes = i + width <= n ? width : n - i;
+        vfloat exponent = set1(0.0f);
+        if (in) {
+            if (lanes == width) {
+                exponent = loadu(in + i);
+            } else {
+                for (int j = 0; j < width; j++) tail[j] = j < lanes ? in[i + j] : 0.0f;
+                exponent = load(tail);
+            }
+        }
+        vfloat x, y, z, d;
+        blocks.template load<ModelDelay>(i, &x, &y, &z, &d);
+        for (int j = 0; j < k; j++) {
+            exponent = add(exponent, logLikelihoodBlock<Math, ModelDelay>(x, y, z, d, terms[j]));
+        }
+        vfloat result = exponentiate ? Math::exp(exponent) : exponent;
+        if (lanes < width) {
+            // neutral values in the unused lanes so the reduction ignores them
+            store(tail, result);
+            for (int j = lanes; j < width; j++) tail[j] = exponentiate ? 0.0f : -INFINITY;
+            result = load(tail);
+            for (int j = 0; j < lanes; j++) out[i + j] = tail[j];
+        } else {
+            storeu(out + i, result);
+        }
+        acc = exponentiate ? add(acc, result) : max(acc, result);
+    }
+    if (exponentiate) {
+        return hsum(acc);
+    }
+    store(tail, acc);
+    float best = tail[0];
+    for (int j = 1; j < width; j++) best = tail[j] > best ? tail[j] : best;
+    return best;
+}
+
+// Chunked driver: anchors are taken 16 at a time so their invariants fit on the stack
+template <class Math, bool ModelDelay, class Blocks>
+static float chunkedSweep(const Blocks& blocks, int n, const float* measurements, const particle* anchorAvgs,
+                          const particle* anchorVars, int k, const float* in, float* out, bool exponentiate) {
+    const int chunk = 16;
+    AnchorTerms terms[chunk];
+    float result = 0.0f;
+    for (int first = 0; first < k; first += chunk) {
+        int count = first + chunk < k ? chunk : k - first;
+        for (int j = 0; j < count; j++) {
+            terms[j] = anchorTerms(measurements[first + j], anchorAvgs[first + j], anchorVars[first + j]);
+        }
+        bool last = first + count == k;
+        result = weightSweep<Math, ModelDelay>(blocks, n, terms, count, first == 0 ? in : out, out,
+                                               exponentiate && last);
+    }
+    return result;
+}
+
+template <class Blocks>
+static float chunkedSweep(const Blocks& blocks, int n, bool delay, const float* measurements,
+                          const particle* anchorAvgs, const particle* anchorVars, int k, const float* in, float* out,
+                          bool exponentiate, Precision precision) {
+    // the delay and precision branches are resolved here once per call, not per particle
+    if (precision == Precision::Fast) {
+        return delay ? chunkedSweep<FastMath, true>(blocks, n, measurements, anchorAvgs, anchorVars, k, in, out,
+                                                    exponentiate)
+                     : chunkedSweep<FastMath, false>(blocks, n, measurements, anchorAvgs, anchorVars, k, in, out,
+                                                     exponentiate);
+    }
+    return delay ? chunkedSweep<ExactMath, true>(blocks, n, measurements, anchorAvgs, anchorVars, k, in, out,
+                                                 exponentiate)
+                 : chunkedSweep<ExactMath, false>(blocks, n, measurements, anchorAvgs, anchorVars, k, in, out,
+                                                  exponentiate);
+}
+
+static float chunkedSweep(const ParticleSet& particles, const float* measurements, const particle* anchorAvgs,
+                          const particle* anchorVars, int k, const float* in, float* out, bool exponentiate,
+                          bool modelAntennaDelay, Precision precision) {
+    return chunkedSweep(FloatBlocks(particles), particles.size(), modelAntennaDelay && particles.delay, measurements,
+                        anchorAvgs, anchorVars, k, in, out, exponentiate, precision);
+}
+#endif
+
+float computeWeightsSimd(const ParticleSet& particles, float measurement, particle anchorAvg,
+                         particle anchorVar, bool modelAntennaDelay, float* weights, Precision precision) {
+#if FILTER_SIMD_WIDTH > 0
+    return chunkedSweep(particles, &measurement, &anchorAvg, &anchorVar, 1, nullptr, weights, true, modelAntennaDelay,
+                        precision);
+#else
+    return computeWeightsScalar(particles, measurement, anchorAvg, anchorVar, modelAntennaDelay, weights);
+#endif
+}
+
+float computeWeightsBatchSimd(const ParticleSet& particles, const float* measurements, const particle* anchorAvgs,
+                              const particle* anchorVars, int k, bool modelAntennaDelay, float* weights,
+                              Precision precision) {
+#if FILTER_SIMD_WIDTH > 0
+    return chunkedSweep(particles, measurements, anchorAvgs, anchorVars, k, nullptr, weights, true, modelAntennaDelay,
+                        precision);
+#else
+    return computeWeightsBatchScalar(particles, measurements, anchorAvgs, anchorVars, k, modelAntennaDelay, weights);
+#endif
+}
+
+template <class Particles>
+static float accumulateScalar(const Particles& particles, const float* measurements, const particle* anchorAvgs,
+                              const particle* anchorVars, int k, bool modelAntennaDelay, float* logWeights) {
+    float best = -INFINITY;
+    for (int i = 0; i < particles.size(); i++) {
+        particle p = particles.get(i);
+        for (int j = 0; j < k; j++) {
+            logWeights[i] += logLikelihood(p, measurements[j], anchorAvgs[j], anchorVars[j], modelAntennaDelay);
+        }
+        best = logWeights[i] > best ? logWeights[i] : best;
+    }
+    return best;
+}
+
+float accumulateLogWeightsScalar(const ParticleSet& particles, const float* measurements, const particle* anchorAvgs,
+                                 const particle* anchorVars, int k, bool modelAntennaDelay, float* logWeights) {
+    return accumulateScalar(particles, measurements, anchorAvgs, anchorVars, k, modelAntennaDelay, logWeights);
+}
+
+float accumulateLogWeightsScalar(const CompactParticleSet& particles, const float* measurements,
+                                 const particle* anchorAvgs, const particle* anchorVars, int k, bool modelAntennaDelay,
+                                 float* logWeights) {
+    return accumulateScalar(particles, measurements, anchorAvgs, anchorVars, k, modelAntennaDelay, logWeights);
+}
+
+float accumulateLogWeightsSimd(const ParticleSet& particles, const float* measurements, const particle* anchorAvgs,
+                               const particle* anchorVars, int k, bool modelAntennaDelay, float* logWeights,
+                               Precision precision) {
+#if FILTER_SIMD_WIDTH > 0
+    return chunkedSweep(particles, measurements, anchorAvgs, anchorVars, k, logWeights, logWeights, false,
+                        modelAntennaDelay, precision);
+#else
+    return accumulateLogWeightsScalar(particles, measurements, anchorAvgs, anchorVars, k, modelAntennaDelay, logWeights);
+#endif
+}
+
+float accumulateLogWeightsSimd(const CompactParticleSet& particles, const float* measurements,
+                               const particle* anchorAvgs, const particle* anchorVars, int k, bool modelAntennaDelay,
+                               float* logWeights, Precision precision) {
+#if FILTER_SIMD_WIDTH > 0
+    return chunkedSweep(FixedBlocks(particles), particles.size(), modelAntennaDelay && particles.delay, measurements,
+                        anchorAvgs, anchorVars, k, logWeights, logWeights, false, precision);
+#else
+    return accumulateLogWeightsScalar(particles, measurements, anchorAvgs, anchorVars, k, modelAntennaDelay, logWeights);
+#endif
+}
+
+#if FILTER_SIMD_WIDTH > 0
+template <class Math>
+static int exponentiateBlocks(const float* logWeights, int n, float offset, float* weights, float* sum,
+                              float* sumSquares) {
+    using namespace simd;
+    const vfloat vOffset = set1(offset);
+    vfloat acc = set1(0.0f), acc2 = set1(0.0f);
+    int i = 0;
+    for (; i + width <= n; i += width) {
+        vfloat w = Math::exp(sub(loadu(logWeights + i), vOffset));
+        storeu(weights + i, w);
+        acc = add(acc, w);
+        acc2 = add(acc2, mul(w, w));
+    }
+    *sum = hsum(acc);
+    *sumSquares = hsum(acc2);
+    return i;
+}
+#endif
+
+float exponentiateWeights(const float* logWeights, int n, float offset, float* weights, float* sumSquares,
+                          Precision precision) {
+    float sum = 0.0f, sum2 = 0.0f;
+    int i = 0;
+#if FILTER_SIMD_WIDTH > 0
+    if (precision == Precision::Fast) {
+        i = exponentiateBlocks<FastMath>(logWeights, n, offset, weights, &sum, &sum2);
+    } else {
+        i = exponentiateBlocks<ExactMath>(logWeights, n, offset, weights, &sum, &sum2);
+    }
+#endif
+    for (; i < n; i++) {
+        float w = std::exp(logWeights[i] - offset);
+        weights[i] = w;
+        sum += w;
+        sum2 += w * w;
+    }
+    *sumSquares = sum2;
+    return sum;
+}
+
+void MomentAccumulator::merge(const MomentAccumulator& other) {
+    weight += other.weight;
+    sx += other.sx;
+    sy += other.sy;
+    sz += other.sz;
+    sd += other.sd;
+    qx += other.qx;
+    qy += other.qy;
+    qz += other.qz;
+    qd += other.qd;
+}
+
+void MomentAccumulator::result(particle* avg, particle* var) const {
+    double mx = sx / weight, my = sy / weight, mz = sz / weight, md = sd / weight;
+    *avg = {static_cast<float>(shift.x + mx), static_cast<float>(shift.y + my), static_cast<float>(shift.z + mz),
+            static_cast<float>(shift.d + md)};
+    *var = {static_cast<float>(std::max(0.0, qx / weight - mx * mx)),
+            static_cast<float>(std::max(0.0, qy / weight - my * my)),
+            static_cast<float>(std::max(0.0, qz / weight - mz * mz)),
+            static_cast<float>(std::max(0.0, qd / weight - md * md))};
+}
+
+// Copy of particle i for the resampled set; d is only read when it is stored.
+// Fixed-point particles are decoded on the way in and encoded on the way out.
+template <bool ModelDelay>
+static inline particle sourceParticle(const ParticleSet& particles, int i) {
+    return {particles.x[i], particles.y[i], particles.z[i], ModelDelay ? particles.d[i] : 0.0f};
+}
+
+template <bool ModelDelay>
+static inline particle sourceParticle(const CompactParticleSet& particles, int i) {
+    const particle& o = particles.origin;
+    const particle& s = particles.step;
+    return {o.x + s.x * particles.x[i], o.y + s.y * particles.y[i], o.z + s.z * particles.z[i],
+            ModelDelay ? o.d + s.d * particles.d[i] : 0.0f};
+}
+
+template <bool ModelDelay>
+static inline void storeParticle(ParticleSet& out, int m, particle p) {
+    out.x[m] = p.x;
+    out.y[m] = p.y;
+    out.z[m] = p.z;
+    if (ModelDelay) {
+        out.d[m] = p.d;
+    }
+}
+
+template <bool ModelDelay>
+static inline void storeParticle(CompactParticleSet& out, int m, particle p) {
+    out.x[m] = CompactParticleSet::quantize(p.x, out.origin.x, out.step.x);
+    out.y[m] = CompactParticleSet::quantize(p.y, out.origin.y, out.step.y);
+    out.z[m] = CompactParticleSet::quantize(p.z, out.origin.z, out.step.z);
+    if (ModelDelay) {
+        out.d[m] = CompactParticleSet::quantize(p.d, out.origin.d, out.step.d);
+    }
+}
+
+template <bool ModelDelay, class In, class Out>
+static int resampleSerial(const In& particles, const float* weights, int nOut, float r, const float* noise,
+                          particle jitterSigma, Out& out, particle* avg, particle* var, int* longestRun) {
+    const int n = particles.size();
+    const float* noiseX = noise;
+    const float* noiseY = noiseX + nOut;
+    const float* noiseZ = noiseY + nOut;
+    const float* noiseD = noiseZ + nOut;
+    out.resize(nOut);
+    float wTarget = 1.0f / nOut;
+    float c = weights[0];
+    int i = 0;
+    int oldi = 0;
+    int repcounter = 0;
+    int duplicates = 0;
+    int longest = 1;
+    MomentAccumulator moments(particles.get(0));
+    for (int m = 0; m < nOut; m++) {
+        float U = r + m * wTarget;
+        while (U > c) {
+            i = (i + 1) % n;
+            c += weights[i];
+        }
+        float minVariance  = 1e-1f;
+        if(i == oldi){
+            minVariance *=repcounter*1.05;
+            repcounter++;
+            duplicates += m > 0;
+            longest = std::max(longest, repcounter);
+        } else{
+            repcounter = 1;
+        }
+        oldi = i;
+        // Resample particle with added Gaussian noise
+        particle newParticle = sourceParticle<ModelDelay>(particles, i);
+        newParticle.x += noiseX[m] * std::max(minVariance, repcounter * jitterSigma.x);
+        newParticle.y += noiseY[m] * std::max(minVariance, repcounter * jitterSigma.y);
+        newParticle.z += noiseZ[m] * std::max(minVariance, repcounter * jitterSigma.z);
+        if (ModelDelay) {
+            newParticle.d = std::max(0.0f, newParticle.d + noiseD[m] * jitterSigma.d);
+        }
+        storeParticle<ModelDelay>(out, m, newParticle);
+        moments.add(newParticle);
+    }
+    moments.result(avg, var);
+    if (longestRun) {
+        *longestRun = longest;
+    }
+    return duplicates;
+}
+
+int resampleSystematic(const ParticleSet& particles, const float* weights, int nOut, float r, const float* noise,
+                       particle jitterSigma, bool modelAntennaDelay, ParticleSet& out, particle* avg, particle* var,
+                       int* longestRun) {
+    out.delay = particles.delay;
+    if (modelAntennaDelay && particles.delay) {
+        return resampleSerial<true>(particles, weights, nOut, r, noise, jitterSigma, out, avg, var, longestRun);
+    }
+    return resampleSerial<false>(particles, weights, nOut, r, noise, jitterSigma, out, avg, var, longestRun);
+}
+
+int resampleSystematic(const CompactParticleSet& particles, const float* weights, int nOut, float r,
+                       const float* noise, particle jitterSigma, bool modelAntennaDelay, CompactParticleSet& out,
+                       particle* avg, particle* var, int* longestRun) {
+    out.delay = particles.delay;
+    if (modelAntennaDelay && particles.delay) {
+        return resampleSerial<true>(particles, weights, nOut, r, noise, jitterSigma, out, avg, var, longestRun);
+    }
+    return resampleSerial<false>(particles, weights, nOut, r, noise, jitterSigma, out, avg, var, longestRun);
+}
+
+// Contiguous ranges of a fixed number of segments, so the split does not depend on the pool
+static int segmentCount(int n) {
+    int count = (n + resampleSegmentSize - 1) / resampleSegmentSize;
+    return std::max(1, std::min(count, resampleMaxSegments));
+}
+
+static void segmentRange(int n, int segments, int s, int* first, int* last) {
+    *first = static_cast<int>(static_cast<int64_t>(n) * s / segments);
+    *last = static_cast<int>(static_cast<int64_t>(n) * (s + 1) / segments);
+}
+
+int resampleSystematicParallel(const ParticleSet& particles, const float* weights, float* cumulative, int nOut,
+                               float r, uint64_t seed, float* noise, particle jitterSigma, bool modelAntennaDelay,
+                               ParticleSet& out, particle* avg, particle* var, ThreadPool& pool,
+                               int* longestRun) {
+    const int n = particles.size();
+    out.delay = particles.delay;
+    out.resize(nOut);
+
+    // Parallel prefix sum: per-segment totals, a serial scan over the segments, then the normalized cumulative
+    const int inSegments = segmentCount(n);
+    double offsets[resampleMaxSegments + 1];
+    pool.parallelFor(inSegments, [&](int s) {
+        int first, last;
+        segmentRange(n, inSegments, s, &first, &last);
+        double sum = 0.0;
+        for (int i = first; i < last; i++) {
+            sum += weights[i];
+        }
+        offsets[s + 1] = sum;
+    });
+    offsets[0] = 0.0;
+    for (int s = 0; s < inSegments; s++) {
+        offsets[s + 1] += offsets[s];
+    }
+    const double total = offsets[inSegments];
+    pool.parallelFor(inSegments, [&](int s) {
+        int first, last;
+        segmentRange(n, inSegments, s, &first, &last);
+        double c = offsets[s];
+        for (int i = first; i < last; i++) {
+            c += weights[i];
+            cumulative[i] = static_cast<float>(c / total);
+        }
+    });
+
+    // Independent jitter streams, one per output segment
+    const int outSegments = segmentCount(nOut);
+    Rng streams[resampleMaxSegments];
+    Rng stream(seed);
+    for (int s = 0; s < outSegments; s++) {
+        streams[s] = stream;
+        stream.jump();
+    }
+
+    const particle shift = particles.get(0);
+    MomentAccumulator moments[resampleMaxSegments];
+    int duplicates[resampleMaxSegments];
+    int longest[resampleMaxSegments];
+    for (int s = 0; s < outSegments; s++) {
+        moments[s] = MomentAccumulator(shift);
+    }
+    const float wTarget = 1.0f / nOut;
+    float* noiseX = noise;
+    float* noiseY = noiseX + nOut;
+    float* noiseZ = noiseY + nOut;
+    float* noiseD = noiseZ + nOut;
+
+    // delay is std::true_type or std::false_type, so the per-particle delay branches fold away
+    auto segment = [&](int s, auto delay) {
+        int first, last;
+        segmentRange(nOut, outSegments, s, &first, &last);
+        const int count = last - first;
+        streams[s].fillGaussian(noiseX + first, count, 0.0f, 1.0f);
+        streams[s].fillGaussian(noiseY + first, count, 0.0f, 1.0f);
+        streams[s].fillGaussian(noiseZ + first, count, 0.0f, 1.0f);
+        if (delay) {
+            streams[s].fillGaussian(noiseD + first, count, 0.0f, 1.0f);
+        }
+
+        // First source particle of the segment, and how many outputs before it already copied that particle:
+        // source i is picked by the outputs with cumulative[i - 1] < r + m * wTarget <= cumulative[i]
+        float U = r + first * wTarget;
+        int i = std::lower_bound(cumulative, cumulative + n, U) - cumulative;
+        i = std::min(i, n - 1);
+        int firstCopy = 0;
+        if (i > 0) {
+            firstCopy = static_cast<int>(std::floor((cumulative[i - 1] - r) / wTarget)) + 1;
+        }
+        int repcounter = first - std::max(0, std::min(firstCopy, first));
+        float c = cumulative[i];
+        int segmentDuplicates = 0;
+        int segmentLongest = 1;
+        for (int m = first; m < last; m++) {
+            U = r + m * wTarget;
+            int previous = i;
+            while (U > c && i < n - 1) {
+                i++;
+                c = cumulative[i];
+            }
+            if (i == previous && m > first) {
+                repcounter++;
+            } else {
+                repcounter = m == first ? repcounter + 1 : 1;
+            }
+            segmentDuplicates += repcounter > 1;
+            segmentLongest = std::max(segmentLongest, repcounter);
+            // same jitter as the serial resampler: duplicates spread wider the longer the run, and the very
+            // first output has no floor when it copies particle 0 (the serial counter starts on that index)
+            float minVariance = repcounter > 1 ? 1e-1f * 1.05f * (repcounter - 1) : (m == 0 && i == 0 ? 0.0f : 1e-1f);
+            particle newParticle = sourceParticle<decltype(delay)::value>(particles, i);
+            newParticle.x += noiseX[m] * std::max(minVariance, repcounter * jitterSigma.x);
+            newParticle.y += noiseY[m] * std::max(minVariance, repcounter * jitterSigma.y);
+            newParticle.z += noiseZ[m] * std::max(minVariance, repcounter * jitterSigma.z);
+            if (delay) {
+                newParticle.d = std::max(0.0f, newParticle.d + noiseD[m] * jitterSigma.d);
+            }
+            storeParticle<decltype(delay)::value>(out, m, newParticle);
+            moments[s].add(newParticle);
+        }
+        duplicates[s] = segmentDuplicates;
+        longest[s] = segmentLongest;
+    };
+    if (modelAntennaDelay && particles.delay) {
+        pool.parallelFor(outSegments, [&](int s) { segment(s, std::true_type()); });
+    } else {
+        pool.parallelFor(outSegments, [&](int s) { segment(s, std::false_type()); });
+    }
+
+    int totalDuplicates = 0;
+    int totalLongest = 1;
+    for (int s = 1; s < outSegments; s++) {
+        moments[0].merge(moments[s]);
+    }
+    for (int s = 0; s < outSegments; s++) {
+        totalDuplicates += duplicates[s];
+        totalLongest = std::max(totalLongest, longest[s]);
+    }
+    moments[0].result(avg, var);
+    if (longestRun) {
+        *longestRun = totalLongest;
+    }
+    return totalDuplicates;
+}
+
+// Moves every particle by its distance along the direction given by its two angles,
+// accumulating the moments of the placed cloud
+template <class Math, bool ModelDelay>
+static void placeOnSphere(ParticleSet& particles, const float* distance, const float* azimuthalAngle,
+                          const float* polarAngle, MomentAccumulator& moments) {
+    for (int i = 0; i < particles.size(); i++) {
+        float sinPolar, cosPolar, sinAzimuthal, cosAzimuthal;
+        Math::sincos(polarAngle[i], &sinPolar, &cosPolar);
+        Math::sincos(azimuthalAngle[i], &sinAzimuthal, &cosAzimuthal);
+
+        particles.x[i] += distance[i] * sinPolar * cosAzimuthal;
+        particles.y[i] += distance[i] * sinPolar * sinAzimuthal;
+        particles.z[i] += distance[i] * cosPolar;
+        moments.add(sourceParticle<ModelDelay>(particles, i));
+    }
+}
+
+template <class Math, bool ModelDelay>
+static void initializeCloud(ParticleSet& particles, float measurement, particle anchorAvg, particle anchorVar,
+                            Rng& rng, float* scratch, particle* avg, particle* var) {
+    const int n = particles.size();
+    float* adjustedDistance = scratch;
+    float* azimuthalAngle = adjustedDistance + n;
+    float* polarAngle = azimuthalAngle + n;
+    for (int i = 0; i < n; i++) {
+        adjustedDistance[i] = measurement;
+    }
+
+    // Step 1: Model antenna delay using exponential distribution
+    if (ModelDelay) {
+        float* ourAntennaDelay = particles.d.data();
+        const float lambda = 10.0f; // 10 gives ~0.1 as the most likely value -> exponential distribution only used for initialization
+
+        // Generate our antenna delay in the range [0, 1)
+        rng.fillExponential(ourAntennaDelay, n, lambda);
+        for (int i = 0; i < n; i++) {
+            while (ourAntennaDelay[i] >= 1.0f) {
+                ourAntennaDelay[i] = rng.exponential(lambda);
+            }
+        }
+
+        // Adjust measurement for antenna delay
+        float* otherAntennaDelay = azimuthalAngle; // reused before the angles are drawn
+        rng.fillGaussian(otherAntennaDelay, n, anchorAvg.d, std::sqrt(anchorVar.d));
+        for (int i = 0; i < n; i++) {
+            float correctedMeasurement = measurement - otherAntennaDelay[i] * measurement;
+            adjustedDistance[i] = correctedMeasurement - ourAntennaDelay[i] * measurement;
+
+            // Ensure non-negative adjusted distance
+            if (adjustedDistance[i] < 0) {
+                adjustedDistance[i] = measurement;
+            }
+        }
+    }
+
+    // Step 2: Handle P_NLoss
+    // if (rng.uniform() < P_NLoss) {
+    //     // Add constant error or Gaussian noise to simulate loss
+    //     adjustedDistance += rng.gaussian(5.0f, 1.0f); // how should we choose these values?
+    // }
+
+    // Step 3: Initialize the particle's position using spherical coordinates
+    rng.fillUniform(azimuthalAngle, n, 0.0f, 2.0f * M_PI); // 0 to 2π
+    rng.fillUniform(polarAngle, n, 0.0f, M_PI);            // 0 to π
+    rng.fillGaussian(particles.x.data(), n, anchorAvg.x, std::sqrt(anchorVar.x));
+    rng.fillGaussian(particles.y.data(), n, anchorAvg.y, std::sqrt(anchorVar.y));
+    rng.fillGaussian(particles.z.data(), n, anchorAvg.z, std::sqrt(anchorVar.z));
+
+    // Step 4: Place the particles on the sphere around the noisy anchor position,
+    // accumulating the estimate average and variance of the equally weighted cloud on the way
+    MomentAccumulator moments(anchorAvg);
+    placeOnSphere<Math, ModelDelay>(particles, adjustedDistance, azimuthalAngle, polarAngle, moments);
+    moments.result(avg, var);
+}
+
+void initializeCloud(ParticleSet& particles, float measurement, particle anchorAvg, particle anchorVar,
+                     bool modelAntennaDelay, Rng& rng, float* scratch, Precision precision, particle* avg,
+                     particle* var) {
+    const bool delay = modelAntennaDelay && particles.delay;
+    if (precision == Precision::Fast) {
+        if (delay) {
+            initializeCloud<FastMath, true>(particles, measurement, anchorAvg, anchorVar, rng, scratch, avg, var);
+        } else {
+            initializeCloud<FastMath, false>(particles, measurement, anchorAvg, anchorVar, rng, scratch, avg, var);
+        }
+    } else if (delay) {
+        initializeCloud<ExactMath, true>(particles, measurement, anchorAvg, anchorVar, rng, scratch, avg, var);
+    } else {
+        initializeCloud<ExactMath, false>(particles, measurement, anchorAvg, anchorVar, rng, scratch, avg, var);
+    }
+}
+
+template <class Particles>
+static void moments(const Particles& particles, const float* weights, particle* avg, particle* var) {
+    MomentAccumulator moments(particles.get(0));
+    for (int i = 0; i < particles.size(); i++) {
+        moments.add(particles.get(i), weights ? weights[i] : 1.0);
+    }
+    moments.result(avg, var);
+}
+
+void computeMoments(const ParticleSet& particles, const float* weights, particle* avg, particle* var) {
+    moments(particles, weights, avg, var);
+}
+
+void computeMoments(const CompactParticleSet& particles, const float* weights, particle* avg, particle* var) {
+    moments(particles, weights, avg, var);
+}
+
+const char* simdBackend() {
+    return FILTER_SIMD_NAME;
+}
@@ -0,0 +1,117 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstdint>
+#include "particles.h"
+#include "precision.h"
+
+class Rng;
+class ThreadPool;
+
+// Likelihood of every particle for one range measurement against an anchor.
+// Writes one weight per particle and returns their sum.
+// The scalar version is the reference implementation, the SIMD version is what Filter uses;
+// precision picks the exact or the fast math policy for the SIMD version.
+float computeWeightsScalar(const ParticleSet& particles, float measurement, particle anchorAvg,
+                           particle anchorVar, bool modelAntennaDelay, float* weights);
+float computeWeightsSimd(const ParticleSet& particles, float measurement, particle anchorAvg,
+                         particle anchorVar, bool modelAntennaDelay, float* weights,
+                         Precision precision = defaultPrecision);
+
+// Joint likelihood of k measurements: the per-measurement exponents are summed for each
+// particle in a single sweep and exponentiated once.
+float computeWeightsBatchScalar(const ParticleSet& particles, const float* measurements, const particle* anchorAvgs,
+                                const particle* anchorVars, int k, bool modelAntennaDelay, float* weights);
+float computeWeightsBatchSimd(const ParticleSet& particles, const float* measurements, const particle* anchorAvgs,
+                              const particle* anchorVars, int k, bool modelAntennaDelay, float* weights,
+                              Precision precision = defaultPrecision);
+
+// Persistent log-domain weights: adds the log-likelihood of k measurements to logWeights
+// in one sweep and returns the new maximum.
+float accumulateLogWeightsScalar(const ParticleSet& particles, const float* measurements, const particle* anchorAvgs,
+                                 const particle* anchorVars, int k, bool modelAntennaDelay, float* logWeights);
+float accumulateLogWeightsSimd(const ParticleSet& particles, const float* measurements, const particle* anchorAvgs,
+                               const particle* anchorVars, int k, bool modelAntennaDelay, float* logWeights,
+                               Precision precision = defaultPrecision);
+// Same sweeps over fixed-point particles, decoded block by block in registers
+float accumulateLogWeightsScalar(const CompactParticleSet& particles, const float* measurements,
+                                 const particle* anchorAvgs, const particle* anchorVars, int k, bool modelAntennaDelay,
+                                 float* logWeights);
+float accumulateLogWeightsSimd(const CompactParticleSet& particles, const float* measurements,
+                               const particle* anchorAvgs, const particle* anchorVars, int k, bool modelAntennaDelay,
+                               float* logWeights, Precision precision = defaultPrecision);
+
+// weights[i] = exp(logWeights[i] - offset); returns the sum and stores the sum of squares
+float exponentiateWeights(const float* logWeights, int n, float offset, float* weights, float* sumSquares,
+                          Precision precision = defaultPrecision);
+
+// Running (weighted) mean and population variance of particles, accumulated in double around a
+// shift close to the data so the sum of squares does not cancel, e.g. at 100k+ particles.
+struct MomentAccumulator {
+    particle shift;
+    double weight = 0;
+    double sx = 0, sy = 0, sz = 0, sd = 0;
+    double qx = 0, qy = 0, qz = 0, qd = 0;
+
+    explicit MomentAccumulator(particle shift = {0, 0, 0, 0}) : shift(shift) {}
+
+    void add(particle p, double w = 1.0) {
+        double dx = p.x - shift.x, dy = p.y - shift.y, dz = p.z - shift.z, dd = p.d - shift.d;
+        weight += w;
+        sx += w * dx;
+        sy += w * dy;
+        sz += w * dz;
+        sd += w * dd;
+        qx += w * dx * dx;
+        qy += w * dy * dy;
+        qz += w * dz * dz;
+        qd += w * dd * dd;
+    }
+
+    // Adds the sums of another accumulator with the same shift
+    void merge(const MomentAccumulator& other);
+    void result(particle* avg, particle* var) const;
+};
+
+// Low-variance (systematic) resampling of nOut particles from normalized weights, starting at r in [0, 1/nOut).
+// noise holds blocks of nOut standard normals for x, y, z and d; repeated copies of a particle get a jitter
+// that grows with the run length. out is resized to nOut, and the mean and variance of the new set are
+// accumulated while it is written, so no further pass is needed for the estimate.
+// Returns how many outputs repeat the particle before them; longestRun, if given, gets the longest run.
+int resampleSystematic(const ParticleSet& particles, const float* weights, int nOut, float r, const float* noise,
+                       particle jitterSigma, bool modelAntennaDelay, ParticleSet& out, particle* avg, particle* var,
+                       int* longestRun = nullptr);
+// Fixed-point version: particles are decoded as they are copied and encoded with the origin and steps
+// already set on out; avg and var describe the jittered particles before encoding
+int resampleSystematic(const CompactParticleSet& particles, const float* weights, int nOut, float r,
+                       const float* noise, particle jitterSigma, bool modelAntennaDelay, CompactParticleSet& out,
+                       particle* avg, particle* var, int* longestRun = nullptr);
+
+// Initial cloud for a first range measurement: the particles are placed on a sphere of radius measurement
+// (less the sampled antenna delays when modelled) around a noisy anchor position. scratch needs room for
+// 3 * n floats; the mean and variance of the new cloud are returned in avg and var.
+void initializeCloud(ParticleSet& particles, float measurement, particle anchorAvg, particle anchorVar,
+                     bool modelAntennaDelay, Rng& rng, float* scratch, Precision precision, particle* avg,
+                     particle* var);
+
+// Parallel systematic resampling, statistically equivalent to resampleSystematic. The outputs are split into
+// at most resampleMaxSegments contiguous segments of at least resampleSegmentSize; each segment finds its first
+// source particle by binary search in a parallel prefix sum, derives its duplicate run length in closed form
+// and draws its jitter from its own stream (seed, jumped once per segment). The result depends on nOut and the
+// seed but not on the number of threads. weights need not be normalized; cumulative needs room for n floats
+// and noise for 4 * nOut.
+static const int resampleSegmentSize = 4096;
+static const int resampleMaxSegments = 64;
+int resampleSystematicParallel(const ParticleSet& particles, const float* weights, float* cumulative, int nOut,
+                               float r, uint64_t seed, float* noise, particle jitterSigma, bool modelAntennaDelay,
+                               ParticleSet& out, particle* avg, particle* var, ThreadPool& pool,
+                               int* longestRun = nullptr);
+
+// Weighted mean and variance of the particles in one pass; null weights means equal weights
+void computeMoments(const ParticleSet& particles, const float* weights, particle* avg, particle* var);
+void computeMoments(const CompactParticleSet& particles, const float* weights, particle* avg, particle* var);
+
+// Name of the instruction set the SIMD kernels were compiled for
+const char* simdBackend();
+
+#endif // KERNELS_H
@@ -0,0 +1,130 @@
+#include "meshScheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+MeshScheduler::MeshScheduler(FilterBank& bank, float stalenessWeight)
+    : bank(bank), stalenessWeight(stalenessWeight) {
+    if (!(stalenessWeight >= 0.0f)) {
+        throw std::invalid_argument("Staleness weight must be non-negative");
+    }
+}
+
+int MeshScheduler::addLink(const BankJob& job) {
+    if (job.node < 0 || job.node >= bank.size() || job.neighbour < -1 || job.neighbour >= bank.size() ||
+        job.neighbour == job.node) {
+        throw std::out_of_range("Link refers to a node outside the bank");
+    }
+    links.push_back({job, 0});
+    return static_cast<int>(links.size()) - 1;
+}
+
+void MeshScheduler::setMeasurement(int link, float measurement) {
+    if (link < 0 || link >= linkCount()) {
+        throw std::out_of_range("Link index out of range");
+    }
+    links[link].job.measurement = measurement;
+}
+
+int MeshScheduler::linkCount() const {
+    return static_cast<int>(links.size());
+}
+
+float MeshScheduler::expectedGain(int link) const {
+    if (link < 0 || link >= linkCount()) {
+        throw std::out_of_range("Link index out of range");
+    }
+    const BankJob& job = links[link].job;
+    particle otherAvg = job.anchorAvg;
+    particle otherVar = job.anchorVar;
+    if (job.neighbour >= 0) {
+        const Filter& neighbour = bank.node(job.neighbour);
+        if (!neighbour.hasEstimate()) {
+            return 0.0f;
+        }
+        otherAvg = neighbour.getEstimateAvg();
+        otherVar = neighbour.getEstimateVar();
+    }
+
+    const Filter& node = bank.node(job.node);
+    particle var = {initVariance, initVariance, initVariance, 0.0f};
+    // squared components of the range direction, isotropic while it is unknown
+    float ux2 = 1.0f / 3, uy2 = 1.0f / 3, uz2 = 1.0f / 3;
+    if (node.hasEstimate()) {
+        particle avg = node.getEstimateAvg();
+        var = node.getEstimateVar();
+        float dx = avg.x - otherAvg.x, dy = avg.y - otherAvg.y, dz = avg.z - otherAvg.z;
+        float norm2 = dx * dx + dy * dy + dz * dz;
+        if (norm2 > 1e-12f) {
+            ux2 = dx * dx / norm2;
+            uy2 = dy * dy / norm2;
+            uz2 = dz * dz / norm2;
+        }
+    }
+    float s2 = ux2 * var.x + uy2 * var.y + uz2 * var.z;
+    float r2 = ux2 * otherVar.x + uy2 * otherVar.y + uz2 * otherVar.z;
+    if (!(s2 > 0.0f)) {
+        return 0.0f;
+    }
+    return s2 * s2 / (s2 + std::max(r2, 0.0f));
+}
+
+int MeshScheduler::tick(int maxUpdates, double budgetMs) {
+    const auto start = std::chrono::steady_clock::now();
+    ticks++;
+
+    // Rank every candidate against the estimates as they are now
+    queue.clear();
+    for (int l = 0; l < linkCount(); l++) {
+        float gain = expectedGain(l);
+        if (gain > 0.0f) {
+            float age = static_cast<float>(ticks - links[l].lastTick);
+            queue.emplace_back(gain * (1.0f + stalenessWeight * age), l);
+        }
+    }
+    std::make_heap(queue.begin(), queue.end());
+
+    // Pop the best links into waves; a node updated in this tick is not ranked again until the next one,
+    // and every wave sees the estimates left by the previous ones
+    nodeTaken.assign(bank.size(), 0);
+    const size_t waveSize = bank.threads();
+    int run = 0;
+    wave.clear();
+    while (run + static_cast<int>(wave.size()) < maxUpdates && !queue.empty()) {
+        std::pop_heap(queue.begin(), queue.end());
+        Link& link = links[queue.back().second];
+        queue.pop_back();
+        if (nodeTaken[link.job.node]) {
+            continue;
+        }
+        nodeTaken[link.job.node] = 1;
+        link.lastTick = ticks;
+        wave.push_back(link.job);
+        if (wave.size() < waveSize && run + static_cast<int>(wave.size()) < maxUpdates && !queue.empty()) {
+            continue;
+        }
+        bank.runRound(wave);
+        run += wave.size();
+        wave.clear();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (budgetMs > 0.0 && elapsed.count() >= budgetMs) {
+            break;
+        }
+    }
+    if (!wave.empty()) {
+        bank.runRound(wave);
+        run += wave.size();
+        wave.clear();
+    }
+    updates += run;
+    return run;
+}
+
+uint64_t MeshScheduler::getTicks() const {
+    return ticks;
+}
+
+uint64_t MeshScheduler::getUpdates() const {
+    return updates;
+}
@@ -0,0 +1,63 @@
+#ifndef MESHSCHEDULER_H
+#define MESHSCHEDULER_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "filterBank.h"
+
+// Picks which ranging updates of a mesh to run instead of updating every pair every round.
+// Each candidate (link) is ranked by the variance its node is expected to lose, scaled up the longer
+// the link has waited, and a tick runs only the best ranked ones through the bank.
+//
+// The expected loss is the linearized range update: with u the unit vector from the neighbour's estimate
+// to the node's, s2 = u' Var(node) u and r2 = u' Var(neighbour) u (the variance the likelihood gives the
+// range), a range removes s2 * s2 / (s2 + r2) of the node's variance along u. A node without an estimate
+// counts as unknown to initVariance in every direction, and a link to such a neighbour is not a candidate.
+class MeshScheduler {
+private:
+    struct Link {
+        BankJob job;
+        // tick on which the link last ran, 0 if never
+        uint64_t lastTick = 0;
+    };
+
+    FilterBank& bank;
+    std::vector<Link> links;
+    float stalenessWeight;
+
+    uint64_t ticks = 0;
+    uint64_t updates = 0;
+
+    // (priority, link) max-heap and the per-tick buffers, reused across ticks
+    std::vector<std::pair<float, int>> queue;
+    std::vector<char> nodeTaken;
+    std::vector<BankJob> wave;
+
+public:
+    // Variance, per axis, given to a node that has no estimate yet
+    static constexpr float initVariance = 1e4f;
+
+    // The bank must outlive the scheduler. A link that waited t ticks has its expected gain
+    // scaled by 1 + stalenessWeight * t, so no link is starved.
+    explicit MeshScheduler(FilterBank& bank, float stalenessWeight = 0.1f);
+
+    // Adds a candidate update, node from the neighbour of job or from its anchor; returns the link index.
+    // Throws std::out_of_range for nodes outside the bank.
+    int addLink(const BankJob& job);
+    // New range for a link, e.g. from the latest ranging exchange
+    void setMeasurement(int link, float measurement);
+    int linkCount() const;
+
+    // Expected variance reduction of running link now, before the staleness scaling; 0 if it is not a candidate
+    float expectedGain(int link) const;
+
+    // Runs up to maxUpdates of the best ranked links, at most one per node, in waves of one update per bank
+    // thread. No new wave starts once budgetMs has elapsed (0: no limit). Returns the number of updates run.
+    int tick(int maxUpdates, double budgetMs = 0.0);
+
+    uint64_t getTicks() const;
+    uint64_t getUpdates() const;
+};
+
+#endif // MESHSCHEDULER_H
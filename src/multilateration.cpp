@@ -0,0 +1,219 @@
+#include "multilateration.h"
+#include <cmath>
+#include "kernels.h"
+#include "rng.h"
+
+// Same regularization as the likelihood in kernels.cpp
+static const double regFactor = 1e-6;
+static const int maxIterations = 20;
+
+// In-place lower Cholesky factor of the n x n symmetric matrix a; false when a pivot falls below
+// tolerance times the largest diagonal entry, i.e. the matrix is (numerically) singular
+static bool cholesky(double a[4][4], int n, double tolerance) {
+    double largest = 0.0;
+    for (int i = 0; i < n; i++) {
+        largest = a[i][i] > largest ? a[i][i] : largest;
+    }
+    if (!(largest > 0.0)) {
+        return false;
+    }
+    for (int j = 0; j < n; j++) {
+        double pivot = a[j][j];
+        for (int k = 0; k < j; k++) {
+            pivot -= a[j][k] * a[j][k];
+        }
+        if (!(pivot > tolerance * largest)) {
+            return false;
+        }
+        a[j][j] = std::sqrt(pivot);
+        for (int i = j + 1; i < n; i++) {
+            double v = a[i][j];
+            for (int k = 0; k < j; k++) {
+                v -= a[i][k] * a[j][k];
+            }
+            a[i][j] = v / a[j][j];
+        }
+    }
+    return true;
+}
+
+// Solves L L^T x = b in place with the factor from cholesky()
+static void choleskySolve(const double l[4][4], int n, double* b) {
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < i; k++) {
+            b[i] -= l[i][k] * b[k];
+        }
+        b[i] /= l[i][i];
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        for (int k = i + 1; k < n; k++) {
+            b[i] -= l[k][i] * b[k];
+        }
+        b[i] /= l[i][i];
+    }
+}
+
+// Range the filter expects from a node at theta (x, y, z, d) to the anchor, and the precision of its error
+struct RangeTerm {
+    double error;
+    double jacobian[4];
+    double weight;
+};
+
+static RangeTerm rangeTerm(const double* theta, float measurement, particle anchorAvg, particle anchorVar,
+                           bool modelAntennaDelay) {
+    double dx = theta[0] - anchorAvg.x, dy = theta[1] - anchorAvg.y, dz = theta[2] - anchorAvg.z;
+    double norm = std::sqrt(dx * dx + dy * dy + dz * dz);
+    if (norm < 1e-9) {
+        norm = 1e-9;
+    }
+    double ux = dx / norm, uy = dy / norm, uz = dz / norm;
+    RangeTerm term;
+    // error = m - |p - a| - (d + a.d) m, as in the likelihood
+    double delay = (modelAntennaDelay ? theta[3] : 0.0) + anchorAvg.d;
+    term.error = measurement - norm - delay * measurement;
+    term.jacobian[0] = -ux;
+    term.jacobian[1] = -uy;
+    term.jacobian[2] = -uz;
+    term.jacobian[3] = -measurement;
+    term.weight = ux * ux / (anchorVar.x + regFactor) + uy * uy / (anchorVar.y + regFactor) +
+                  uz * uz / (anchorVar.z + regFactor);
+    return term;
+}
+
+bool multilaterate(const float* measurements, const particle* anchorAvgs, const particle* anchorVars, int k,
+                   bool modelAntennaDelay, RangeFix* fix) {
+    const int unknowns = modelAntennaDelay ? 4 : 3;
+    if (k <= unknowns) {
+        return false;
+    }
+
+    // Closed-form seed: subtracting the first sphere equation from the others leaves a linear system
+    // 2 (a_i - a_0) . p = |a_i|^2 - |a_0|^2 - r_i^2 + r_0^2, solved by least squares with the delay at 0
+    double ata[4][4] = {}, atb[4] = {};
+    const particle a0 = anchorAvgs[0];
+    const double r0 = measurements[0] * (1.0 - a0.d);
+    const double a0Norm2 = double(a0.x) * a0.x + double(a0.y) * a0.y + double(a0.z) * a0.z;
+    for (int i = 1; i < k; i++) {
+        const particle a = anchorAvgs[i];
+        const double r = measurements[i] * (1.0 - a.d);
+        const double row[3] = {2.0 * (a.x - a0.x), 2.0 * (a.y - a0.y), 2.0 * (a.z - a0.z)};
+        const double rhs = double(a.x) * a.x + double(a.y) * a.y + double(a.z) * a.z - a0Norm2 - r * r + r0 * r0;
+        for (int p = 0; p < 3; p++) {
+            for (int q = 0; q < 3; q++) {
+                ata[p][q] += row[p] * row[q];
+            }
+            atb[p] += row[p] * rhs;
+        }
+    }
+    if (!cholesky(ata, 3, 1e-9)) {
+        return false;
+    }
+    choleskySolve(ata, 3, atb);
+    double theta[4] = {atb[0], atb[1], atb[2], 0.0};
+
+    // Gauss-Newton on the weighted range errors until the step vanishes, then one more pass so the
+    // normal matrix and chi2 are taken at the solution
+    double normal[4][4];
+    bool converged = false;
+    for (int iteration = 0; iteration <= maxIterations; iteration++) {
+        double gradient[4] = {};
+        for (int p = 0; p < 4; p++) {
+            for (int q = 0; q < 4; q++) {
+                normal[p][q] = 0.0;
+            }
+        }
+        double chi2 = 0.0;
+        for (int i = 0; i < k; i++) {
+            RangeTerm term = rangeTerm(theta, measurements[i], anchorAvgs[i], anchorVars[i], modelAntennaDelay);
+            for (int p = 0; p < unknowns; p++) {
+                for (int q = 0; q < unknowns; q++) {
+                    normal[p][q] += term.weight * term.jacobian[p] * term.jacobian[q];
+                }
+                gradient[p] += term.weight * term.jacobian[p] * term.error;
+            }
+            chi2 += term.weight * term.error * term.error;
+        }
+        if (!cholesky(normal, unknowns, 1e-12)) {
+            return false;
+        }
+        fix->chi2 = chi2;
+        if (converged || iteration == maxIterations) {
+            break;
+        }
+        choleskySolve(normal, unknowns, gradient);
+        double step = 0.0;
+        for (int p = 0; p < unknowns; p++) {
+            theta[p] -= gradient[p];
+            step += gradient[p] * gradient[p];
+        }
+        if (!std::isfinite(step)) {
+            return false;
+        }
+        converged = step < 1e-12;
+    }
+
+    // covariance = normal^-1, column by column from the factor
+    for (int p = 0; p < 4; p++) {
+        for (int q = 0; q < 4; q++) {
+            fix->covariance[p][q] = 0.0;
+        }
+    }
+    for (int q = 0; q < unknowns; q++) {
+        double column[4] = {};
+        column[q] = 1.0;
+        choleskySolve(normal, unknowns, column);
+        for (int p = 0; p < unknowns; p++) {
+            fix->covariance[p][q] = column[p];
+        }
+    }
+    fix->mean = {float(theta[0]), float(theta[1]), float(theta[2]), modelAntennaDelay ? float(theta[3]) : 0.0f};
+    fix->dof = k - unknowns;
+    return true;
+}
+
+void sampleFix(ParticleSet& particles, const RangeFix& fix, float inflation, bool modelAntennaDelay, Rng& rng,
+               float* scratch, particle* avg, particle* var) {
+    const int n = particles.size();
+    const int dims = modelAntennaDelay && particles.delay ? 4 : 3;
+    // floors of 1 mm and 1e-4 standard deviation keep an exact fix from collapsing the cloud to a point
+    const double floors[4] = {1e-6, 1e-6, 1e-6, 1e-8};
+    double l[4][4];
+    for (int p = 0; p < 4; p++) {
+        for (int q = 0; q < 4; q++) {
+            l[p][q] = inflation * fix.covariance[p][q] + (p == q ? floors[p] : 0.0);
+        }
+    }
+    if (!cholesky(l, dims, 0.0)) {
+        // not positive definite after rounding, keep the variances only
+        for (int p = 0; p < 4; p++) {
+            for (int q = 0; q < 4; q++) {
+                l[p][q] = p == q ? std::sqrt(inflation * std::fabs(fix.covariance[p][p]) + floors[p]) : 0.0;
+            }
+        }
+    }
+
+    rng.fillGaussian(scratch, dims * n, 0.0f, 1.0f);
+    const float mean[4] = {fix.mean.x, fix.mean.y, fix.mean.z, fix.mean.d};
+    float* axes[4] = {particles.x.data(), particles.y.data(), particles.z.data(), particles.d.data()};
+    for (int p = 0; p < dims; p++) {
+        float* out = axes[p];
+        for (int i = 0; i < n; i++) {
+            double v = mean[p];
+            for (int q = 0; q <= p; q++) {
+                v += l[p][q] * scratch[q * n + i];
+            }
+            out[i] = static_cast<float>(v);
+        }
+    }
+    MomentAccumulator moments(fix.mean);
+    for (int i = 0; i < n; i++) {
+        if (dims == 4) {
+            // the delay stays in [0, 1) like the sphere initialization draws it
+            float d = particles.d[i];
+            particles.d[i] = d < 0.0f ? 0.0f : (d >= 1.0f ? 0.999f : d);
+        }
+        moments.add(particles.get(i));
+    }
+    moments.result(avg, var);
+}
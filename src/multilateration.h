@@ -0,0 +1,35 @@
+#ifndef MULTILATERATION_H
+#define MULTILATERATION_H
+
+#include "particles.h"
+
+class Rng;
+
+// How a filter places its cloud on the first update and after a collapse:
+//   Sphere          -> on the sphere of the current measurement around its anchor
+//   Multilateration -> around the position fixed by the last ranges, see Filter::setInitMode
+enum class InitMode { Sphere, Multilateration };
+
+// Gaussian fit of the position (and relative antenna delay) seen through several ranges
+struct RangeFix {
+    particle mean;
+    // x, y, z, d covariance, row major; the d row and column are zero without delay modelling
+    double covariance[4][4];
+    // weighted squared residuals and their degrees of freedom, chi2 / dof near 1 for consistent ranges
+    double chi2;
+    int dof;
+};
+
+// Least squares fix of k ranges, measurements[i] from anchorAvgs[i], weighted like the filter's likelihood.
+// A closed-form linear solve seeds a few Gauss-Newton steps on the exact ranges; the covariance is the inverse
+// of the final normal matrix. Needs one range more than unknowns (3, or 4 with the delay) and anchors that
+// are not coplanar; returns false when they are degenerate.
+bool multilaterate(const float* measurements, const particle* anchorAvgs, const particle* anchorVars, int k,
+                   bool modelAntennaDelay, RangeFix* fix);
+
+// Fills particles with draws from the fix, its covariance scaled by inflation; scratch needs room for 4 * n
+// floats. The mean and variance of the new cloud are returned in avg and var.
+void sampleFix(ParticleSet& particles, const RangeFix& fix, float inflation, bool modelAntennaDelay, Rng& rng,
+               float* scratch, particle* avg, particle* var);
+
+#endif // MULTILATERATION_H
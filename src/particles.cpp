@@ -0,0 +1,337 @@
+#include "particles.h"
+#include "arena.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+template <class T>
+static T* allocateAligned(int capacity) {
+    if (capacity == 0) {
+        return nullptr;
+    }
+    // aligned operator new rather than aligned_alloc, so allocation hooks see these buffers too
+    return static_cast<T*>(::operator new(capacity * sizeof(T), std::align_val_t(AlignedArray::alignment)));
+}
+
+static void freeAligned(void* ptr) {
+    if (ptr) {
+        ::operator delete(ptr, std::align_val_t(AlignedArray::alignment));
+    }
+}
+
+static int paddedCapacity(int n, int padding = AlignedArray::padding) {
+    return (n + padding - 1) / padding * padding;
+}
+
+AlignedArray::AlignedArray(int n, float value) {
+    resize(n, value);
+}
+
+AlignedArray::AlignedArray(float* memory, int capacity) : ptr(memory), capacity(capacity), owned(false) {
+    for (int i = 0; i < capacity; i++) {
+        ptr[i] = 0.0f;
+    }
+}
+
+AlignedArray::AlignedArray(const AlignedArray& other) : arena(other.arena) {
+    capacity = other.capacity;
+    n = other.n;
+    ptr = allocate(&capacity);
+    if (other.capacity > 0) {
+        std::memcpy(ptr, other.ptr, other.capacity * sizeof(float));
+    }
+    for (int i = other.capacity; i < capacity; i++) {
+        ptr[i] = 0.0f;
+    }
+}
+
+AlignedArray::AlignedArray(AlignedArray&& other) noexcept {
+    swap(other);
+}
+
+AlignedArray& AlignedArray::operator=(AlignedArray other) noexcept {
+    swap(other);
+    return *this;
+}
+
+AlignedArray::~AlignedArray() {
+    release();
+}
+
+// Memory for at least *capacity floats, *capacity is raised to what the heap or the arena granted
+float* AlignedArray::allocate(int* capacity) {
+    if (arena) {
+        size_t bytes = ParticleArena::blockSize(*capacity * sizeof(float));
+        *capacity = static_cast<int>(bytes / sizeof(float));
+        return static_cast<float*>(arena->allocate(bytes));
+    }
+    *capacity = paddedCapacity(*capacity);
+    return allocateAligned<float>(*capacity);
+}
+
+void AlignedArray::release() {
+    if (!owned) {
+        return;
+    }
+    if (arena) {
+        arena->deallocate(ptr, capacity * sizeof(float));
+    } else {
+        freeAligned(ptr);
+    }
+}
+
+void AlignedArray::resize(int n, float value) {
+    reserve(n);
+    for (int i = this->n; i < n; i++) {
+        ptr[i] = value;
+    }
+    // keep the padding zeroed so vector loads past the end stay finite
+    for (int i = n; i < capacity; i++) {
+        ptr[i] = 0.0f;
+    }
+    this->n = n;
+}
+
+void AlignedArray::reserve(int capacity) {
+    if (capacity <= this->capacity) {
+        return;
+    }
+    if (!owned) {
+        throw std::length_error("AlignedArray view cannot grow past its fixed capacity");
+    }
+    int newCapacity = capacity;
+    float* newPtr = allocate(&newCapacity);
+    if (n > 0) {
+        std::memcpy(newPtr, ptr, n * sizeof(float));
+    }
+    for (int i = n; i < newCapacity; i++) {
+        newPtr[i] = 0.0f;
+    }
+    release();
+    ptr = newPtr;
+    this->capacity = newCapacity;
+}
+
+void AlignedArray::swap(AlignedArray& other) noexcept {
+    std::swap(ptr, other.ptr);
+    std::swap(n, other.n);
+    std::swap(capacity, other.capacity);
+    std::swap(owned, other.owned);
+    arena.swap(other.arena);
+}
+
+void AlignedArray::setArena(std::shared_ptr<ParticleArena> arena) {
+    if (arena == this->arena && owned) {
+        return;
+    }
+    AlignedArray moved;
+    moved.arena = std::move(arena);
+    moved.reserve(capacity);
+    if (n > 0) {
+        std::memcpy(moved.ptr, ptr, n * sizeof(float));
+    }
+    moved.n = n;
+    swap(moved);
+}
+
+void ParticleSet::resize(int n) {
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    if (delay) {
+        d.resize(n);
+    }
+}
+
+void ParticleSet::reserve(int capacity) {
+    x.reserve(capacity);
+    y.reserve(capacity);
+    z.reserve(capacity);
+    if (delay) {
+        d.reserve(capacity);
+    }
+}
+
+void ParticleSet::swap(ParticleSet& other) noexcept {
+    x.swap(other.x);
+    y.swap(other.y);
+    z.swap(other.z);
+    d.swap(other.d);
+    std::swap(delay, other.delay);
+}
+
+void ParticleSet::setArena(const std::shared_ptr<ParticleArena>& arena) {
+    x.setArena(arena);
+    y.setArena(arena);
+    z.setArena(arena);
+    d.setArena(arena);
+}
+
+AlignedInt16Array::AlignedInt16Array(const AlignedInt16Array& other) : arena(other.arena) {
+    capacity = other.capacity;
+    n = other.n;
+    ptr = allocate(&capacity);
+    if (other.capacity > 0) {
+        std::memcpy(ptr, other.ptr, other.capacity * sizeof(int16_t));
+    }
+    for (int i = other.capacity; i < capacity; i++) {
+        ptr[i] = 0;
+    }
+}
+
+AlignedInt16Array::AlignedInt16Array(AlignedInt16Array&& other) noexcept {
+    swap(other);
+}
+
+AlignedInt16Array& AlignedInt16Array::operator=(AlignedInt16Array other) noexcept {
+    swap(other);
+    return *this;
+}
+
+AlignedInt16Array::~AlignedInt16Array() {
+    release();
+}
+
+int16_t* AlignedInt16Array::allocate(int* capacity) {
+    if (arena) {
+        size_t bytes = ParticleArena::blockSize(*capacity * sizeof(int16_t));
+        *capacity = static_cast<int>(bytes / sizeof(int16_t));
+        return static_cast<int16_t*>(arena->allocate(bytes));
+    }
+    *capacity = paddedCapacity(*capacity, padding);
+    return allocateAligned<int16_t>(*capacity);
+}
+
+void AlignedInt16Array::release() {
+    if (arena) {
+        arena->deallocate(ptr, capacity * sizeof(int16_t));
+    } else {
+        freeAligned(ptr);
+    }
+}
+
+void AlignedInt16Array::resize(int n) {
+    reserve(n);
+    for (int i = this->n; i < n; i++) {
+        ptr[i] = 0;
+    }
+    for (int i = n; i < capacity; i++) {
+        ptr[i] = 0;
+    }
+    this->n = n;
+}
+
+void AlignedInt16Array::reserve(int capacity) {
+    if (capacity <= this->capacity) {
+        return;
+    }
+    int newCapacity = capacity;
+    int16_t* newPtr = allocate(&newCapacity);
+    if (n > 0) {
+        std::memcpy(newPtr, ptr, n * sizeof(int16_t));
+    }
+    for (int i = n; i < newCapacity; i++) {
+        newPtr[i] = 0;
+    }
+    release();
+    ptr = newPtr;
+    this->capacity = newCapacity;
+}
+
+void AlignedInt16Array::swap(AlignedInt16Array& other) noexcept {
+    std::swap(ptr, other.ptr);
+    std::swap(n, other.n);
+    std::swap(capacity, other.capacity);
+    arena.swap(other.arena);
+}
+
+void AlignedInt16Array::assign(const AlignedInt16Array& other) {
+    resize(other.n);
+    if (other.n > 0) {
+        std::memcpy(ptr, other.ptr, other.n * sizeof(int16_t));
+    }
+}
+
+void AlignedInt16Array::setArena(std::shared_ptr<ParticleArena> arena) {
+    if (arena == this->arena) {
+        return;
+    }
+    AlignedInt16Array moved;
+    moved.arena = std::move(arena);
+    moved.reserve(capacity);
+    if (n > 0) {
+        std::memcpy(moved.ptr, ptr, n * sizeof(int16_t));
+    }
+    moved.n = n;
+    swap(moved);
+}
+
+void CompactParticleSet::resize(int n) {
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    if (delay) {
+        d.resize(n);
+    }
+}
+
+void CompactParticleSet::reserve(int capacity) {
+    x.reserve(capacity);
+    y.reserve(capacity);
+    z.reserve(capacity);
+    if (delay) {
+        d.reserve(capacity);
+    }
+}
+
+void CompactParticleSet::swap(CompactParticleSet& other) noexcept {
+    x.swap(other.x);
+    y.swap(other.y);
+    z.swap(other.z);
+    d.swap(other.d);
+    std::swap(origin, other.origin);
+    std::swap(step, other.step);
+    std::swap(delay, other.delay);
+}
+
+void CompactParticleSet::assign(const CompactParticleSet& other) {
+    delay = other.delay;
+    x.assign(other.x);
+    y.assign(other.y);
+    z.assign(other.z);
+    if (delay) {
+        d.assign(other.d);
+    }
+    origin = other.origin;
+    step = other.step;
+}
+
+void CompactParticleSet::setArena(const std::shared_ptr<ParticleArena>& arena) {
+    x.setArena(arena);
+    y.setArena(arena);
+    z.setArena(arena);
+    d.setArena(arena);
+}
+
+void CompactParticleSet::setScale(particle avg, particle var, particle margin) {
+    auto stepFor = [](float variance, float margin) {
+        float range = sigmas * std::sqrt(std::max(0.0f, variance)) + margin;
+        // a non-finite spread falls back to the margin alone
+        return std::isfinite(range) && range > 0.0f ? range / 32767.0f : margin / 32767.0f;
+    };
+    origin = avg;
+    step = {stepFor(var.x, margin.x), stepFor(var.y, margin.y), stepFor(var.z, margin.z),
+            stepFor(var.d, margin.d)};
+}
+
+void CompactParticleSet::rescale(particle avg, particle var, particle margin) {
+    const particle oldOrigin = origin, oldStep = step;
+    setScale(avg, var, margin);
+    for (int i = 0; i < size(); i++) {
+        set(i, {oldOrigin.x + oldStep.x * x[i], oldOrigin.y + oldStep.y * y[i], oldOrigin.z + oldStep.z * z[i],
+                delay ? oldOrigin.d + oldStep.d * d[i] : 0.0f});
+    }
+}
@@ -0,0 +1,167 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+class ParticleArena;
+
+// Define the particle particle structure
+struct particle {
+    float x, y, z, d;
+};
+
+// Cache-line aligned float array, padded so SIMD kernels can always load full vectors.
+// The memory comes from the heap, or from a shared ParticleArena after setArena.
+class AlignedArray {
+private:
+    float* ptr = nullptr;
+    int n = 0;
+    int capacity = 0;
+    bool owned = true;
+    std::shared_ptr<ParticleArena> arena;
+
+    float* allocate(int* capacity);
+    void release();
+
+public:
+    static const int alignment = 64;
+    static const int padding = alignment / sizeof(float);
+
+    AlignedArray() = default;
+    explicit AlignedArray(int n, float value = 0.0f);
+    // View over caller-owned aligned memory of a fixed capacity (a multiple of padding); it is never
+    // freed or grown, reserving past it throws std::length_error. Copies of a view own their memory.
+    AlignedArray(float* memory, int capacity);
+    AlignedArray(const AlignedArray& other);
+    AlignedArray(AlignedArray&& other) noexcept;
+    AlignedArray& operator=(AlignedArray other) noexcept;
+    ~AlignedArray();
+
+    void resize(int n, float value = 0.0f);
+    // Grow the allocation without changing the size, later resizes up to it do not allocate
+    void reserve(int capacity);
+    void swap(AlignedArray& other) noexcept;
+    // Move the values to memory drawn from arena (null: the heap); copies draw from the same arena
+    void setArena(std::shared_ptr<ParticleArena> arena);
+
+    int size() const { return n; }
+    bool empty() const { return n == 0; }
+    float* data() { return ptr; }
+    const float* data() const { return ptr; }
+    float& operator[](int i) { return ptr[i]; }
+    const float& operator[](int i) const { return ptr[i]; }
+};
+
+// Structure-of-arrays particle storage: one aligned array per component.
+// d is only stored when antenna delay is modelled (delay = true); without it a particle takes
+// 12 bytes and get() reports d = 0.
+struct ParticleSet {
+    AlignedArray x, y, z, d;
+    bool delay = true;
+
+    int size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+    void resize(int n);
+    void reserve(int capacity);
+    void swap(ParticleSet& other) noexcept;
+    void setArena(const std::shared_ptr<ParticleArena>& arena);
+
+    particle get(int i) const { return {x[i], y[i], z[i], delay ? d[i] : 0.0f}; }
+    void set(int i, particle p) {
+        x[i] = p.x;
+        y[i] = p.y;
+        z[i] = p.z;
+        if (delay) {
+            d[i] = p.d;
+        }
+    }
+};
+
+// How a Filter keeps its particles between updates
+enum class ParticleStorage {
+    Float,  // float32 per component
+    Fixed16 // 16-bit fixed-point offsets from the estimate, see CompactParticleSet
+};
+
+// Cache-line aligned int16 array padded to whole cache lines, the fixed-point counterpart of AlignedArray
+class AlignedInt16Array {
+private:
+    int16_t* ptr = nullptr;
+    int n = 0;
+    int capacity = 0;
+    std::shared_ptr<ParticleArena> arena;
+
+    int16_t* allocate(int* capacity);
+    void release();
+
+public:
+    static const int padding = AlignedArray::alignment / sizeof(int16_t);
+
+    AlignedInt16Array() = default;
+    AlignedInt16Array(const AlignedInt16Array& other);
+    AlignedInt16Array(AlignedInt16Array&& other) noexcept;
+    AlignedInt16Array& operator=(AlignedInt16Array other) noexcept;
+    ~AlignedInt16Array();
+
+    void resize(int n);
+    void reserve(int capacity);
+    void swap(AlignedInt16Array& other) noexcept;
+    // Copy the values of other into this array's memory, which stays in its own arena
+    void assign(const AlignedInt16Array& other);
+    void setArena(std::shared_ptr<ParticleArena> arena);
+
+    int size() const { return n; }
+    int16_t* data() { return ptr; }
+    const int16_t* data() const { return ptr; }
+    int16_t& operator[](int i) { return ptr[i]; }
+    const int16_t& operator[](int i) const { return ptr[i]; }
+};
+
+// Particles as 16-bit fixed-point offsets, component = origin + step * q, so a particle takes 6 bytes
+// (8 with the delay) instead of 12 (16). The origin and steps belong to the whole set and are picked
+// with setScale() before it is written; values outside the covered range are clamped to its edge.
+struct CompactParticleSet {
+    AlignedInt16Array x, y, z, d;
+    particle origin = {0, 0, 0, 0};
+    particle step = {1, 1, 1, 1};
+    bool delay = true;
+
+    // Standard deviations on either side of the mean covered by setScale
+    static constexpr float sigmas = 8.0f;
+
+    int size() const { return x.size(); }
+    bool empty() const { return size() == 0; }
+    void resize(int n);
+    void reserve(int capacity);
+    void swap(CompactParticleSet& other) noexcept;
+    // Copy the particles and scale of other, keeping this set's memory and arena
+    void assign(const CompactParticleSet& other);
+    void setArena(const std::shared_ptr<ParticleArena>& arena);
+    // Center the encoding on avg and cover sigmas standard deviations of var, plus margin on every axis
+    void setScale(particle avg, particle var, particle margin);
+    // setScale, then encode the particles already stored again for the new origin and step
+    void rescale(particle avg, particle var, particle margin);
+
+    particle get(int i) const {
+        return {origin.x + step.x * x[i], origin.y + step.y * y[i], origin.z + step.z * z[i],
+                delay ? origin.d + step.d * d[i] : 0.0f};
+    }
+    void set(int i, particle p) {
+        x[i] = quantize(p.x, origin.x, step.x);
+        y[i] = quantize(p.y, origin.y, step.y);
+        z[i] = quantize(p.z, origin.z, step.z);
+        if (delay) {
+            d[i] = quantize(p.d, origin.d, step.d);
+        }
+    }
+    static int16_t quantize(float v, float origin, float step) {
+        float q = (v - origin) / step;
+        q = q < -32767.0f ? -32767.0f : (q > 32767.0f ? 32767.0f : q);
+        // round half away from zero, NaN lands on the origin
+        return static_cast<int16_t>(q >= 0.0f ? q + 0.5f : (q < 0.0f ? q - 0.5f : 0.0f));
+    }
+};
+
+#endif // PARTICLES_H
@@ -0,0 +1,62 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+#include <cmath>
+#include "simd.h"
+
+// Accuracy of the math in the hot loops: Exact keeps the library functions and full
+// precision vector exp/sqrt/div, Fast trades a few digits for polynomial and estimate instructions.
+enum class Precision { Exact, Fast };
+
+// Build with -DFILTER_FAST_MATH=1 to make Fast the default of every Filter
+#ifndef FILTER_FAST_MATH
+#define FILTER_FAST_MATH 0
+#endif
+const Precision defaultPrecision = FILTER_FAST_MATH ? Precision::Fast : Precision::Exact;
+
+// Math policies the kernels are instantiated with
+struct ExactMath {
+#if FILTER_SIMD_WIDTH > 0
+    static simd::vfloat exp(simd::vfloat x) { return simd::exp(x); }
+    // sqrt(x) and 1/x for positive x
+    static void rootAndInverse(simd::vfloat x, simd::vfloat* root, simd::vfloat* inverse) {
+        *root = simd::sqrt(x);
+        *inverse = simd::div(simd::set1(1.0f), x);
+    }
+#endif
+    static void sincos(float x, float* s, float* c) {
+        *s = std::sin(x);
+        *c = std::cos(x);
+    }
+};
+
+struct FastMath {
+#if FILTER_SIMD_WIDTH > 0
+    static simd::vfloat exp(simd::vfloat x) { return simd::expFast(x); }
+    // one rsqrt gives both: sqrt(x) = x / sqrt(x), 1/x = (1/sqrt(x))^2
+    static void rootAndInverse(simd::vfloat x, simd::vfloat* root, simd::vfloat* inverse) {
+        simd::vfloat r = simd::rsqrt(x);
+        *root = simd::mul(x, r);
+        *inverse = simd::mul(r, r);
+    }
+#endif
+    // Cephes sinf/cosf polynomials after reduction to [-pi/4, pi/4], both from one reduction
+    static void sincos(float x, float* s, float* c) {
+        float fq = x * 0.636619772367581f; // 2 / pi
+        int q = static_cast<int>(fq >= 0.0f ? fq + 0.5f : fq - 0.5f);
+        fq = static_cast<float>(q);
+        float r = ((x - fq * 1.5703125f) - fq * 4.837512969970703125e-4f) - fq * 7.54978995489188216e-8f;
+        float r2 = r * r;
+        float sr = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+        float cr = 1.0f - 0.5f * r2 +
+                   r2 * r2 * (4.166664568298827e-2f + r2 * (-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));
+        switch (q & 3) {
+            case 0: *s = sr; *c = cr; break;
+            case 1: *s = cr; *c = -sr; break;
+            case 2: *s = -sr; *c = -cr; break;
+            default: *s = -cr; *c = sr; break;
+        }
+    }
+};
+
+#endif // PRECISION_H
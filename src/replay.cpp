@@ -0,0 +1,148 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "filter.h"
+#include "threadPool.h"
+#include "trace.h"
+
+// Offline replay of measurement traces, built with `make replay`:
+//   ./replay [--n N] [--delay] [--seed S] [--repeat R] [--node ID] [--threads T] trace...
+// Every node of every trace gets its own Filter, seeded with seed + node like FilterBank, and
+// its calls are replayed in recorded order. The anchor estimates a node saw are in the trace,
+// so the streams are independent and run in parallel over T threads (0: every hardware thread).
+
+struct Stream {
+    const TraceReader* trace;
+    uint32_t node;
+    std::vector<size_t> calls;
+    std::unique_ptr<Filter> filter;
+};
+
+static void usage() {
+    std::cerr << "usage: replay [--n N] [--delay] [--seed S] [--repeat R] [--node ID] [--threads T] trace..."
+              << std::endl;
+}
+
+int main(int argc, char** argv) {
+    int N = 10000;
+    bool delay = false;
+    unsigned int seed = Rng::defaultSeed;
+    int repeat = 1;
+    long onlyNode = -1;
+    int threads = 1;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--n" && hasValue) {
+            N = std::atoi(argv[++i]);
+        } else if (arg == "--delay") {
+            delay = true;
+        } else if (arg == "--seed" && hasValue) {
+            seed = std::strtoul(argv[++i], nullptr, 0);
+        } else if (arg == "--repeat" && hasValue) {
+            repeat = std::atoi(argv[++i]);
+        } else if (arg == "--node" && hasValue) {
+            onlyNode = std::atol(argv[++i]);
+        } else if (arg == "--threads" && hasValue) {
+            threads = std::atoi(argv[++i]);
+        } else if (arg.compare(0, 2, "--") == 0) {
+            usage();
+            return 2;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.empty() || N < 1 || repeat < 1) {
+        usage();
+        return 2;
+    }
+
+    std::vector<std::unique_ptr<TraceReader>> traces;
+    std::vector<Stream> streams;
+    size_t records = 0;
+    try {
+        for (const std::string& path : paths) {
+            traces.emplace_back(new TraceReader(path));
+            const TraceReader& trace = *traces.back();
+            records += trace.size();
+            // index the calls of each node, nodes are small integers
+            const size_t firstStream = streams.size();
+            std::vector<int> streamOfNode;
+            for (size_t i = 0; i < trace.size(); i++) {
+                TraceRecord r = trace[i];
+                if (r.batch == 0 || (onlyNode >= 0 && r.node != onlyNode)) {
+                    continue;
+                }
+                if (r.node >= streamOfNode.size()) {
+                    streamOfNode.resize(r.node + 1, -1);
+                }
+                if (streamOfNode[r.node] < 0) {
+                    streamOfNode[r.node] = streams.size();
+                    streams.push_back({&trace, r.node, {}, nullptr});
+                }
+                streams[streamOfNode[r.node]].calls.push_back(i);
+            }
+            for (size_t s = firstStream; s < streams.size(); s++) {
+                streams[s].filter.reset(new Filter(N, delay, seed + streams[s].node));
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    ThreadPool pool(threads);
+    auto start = std::chrono::steady_clock::now();
+    try {
+        pool.parallelFor(streams.size(), [&](int s) {
+            Stream& stream = streams[s];
+            for (int round = 0; round < repeat; round++) {
+                for (size_t call : stream.calls) {
+                    replayCall(*stream.trace, call, *stream.filter);
+                }
+            }
+        });
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t calls = 0;
+    double particleUpdates = 0;
+    for (const Stream& stream : streams) {
+        calls += stream.calls.size() * repeat;
+        particleUpdates += double(stream.calls.size()) * repeat * stream.filter->getN();
+    }
+    std::cout << "records " << records << ", filters " << streams.size() << ", calls " << calls << " in " << seconds
+              << " s" << std::endl;
+    std::cout << "throughput " << calls / seconds << " calls/s, " << particleUpdates / seconds << " particles/s on "
+              << pool.size() << " threads" << std::endl;
+#if !FILTER_STATS
+    std::cerr << "built with FILTER_STATS=0: the reinitializations and resamples columns are left empty" << std::endl;
+#endif
+    std::cout << "trace,node,x,y,z,d,varx,vary,varz,vard,reinitializations,resamples" << std::endl;
+    for (const Stream& stream : streams) {
+        int file = 0;
+        while (traces[file].get() != stream.trace) {
+            file++;
+        }
+        particle avg = stream.filter->getEstimateAvg();
+        particle var = stream.filter->getEstimateVar();
+        std::cout << paths[file] << "," << stream.node << "," << avg.x << "," << avg.y << "," << avg.z << "," << avg.d
+                  << "," << var.x << "," << var.y << "," << var.z << "," << var.d << ",";
+#if FILTER_STATS
+        FilterStats stats = stream.filter->getStats();
+        std::cout << stats.reinitializations << "," << stats.resamples;
+#else
+        std::cout << ",";
+#endif
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include "rng.h"
+#include <cmath>
+#include <stdexcept>
+
+static inline uint32_t rotl(uint32_t x, int k) {
+    return (x << k) | (x >> (32 - k));
+}
+
+static uint64_t splitmix64(uint64_t& state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+Rng::Rng(uint64_t seed) {
+    this->seed(seed);
+}
+
+void Rng::seed(uint64_t seed) {
+    uint64_t a = splitmix64(seed);
+    uint64_t b = splitmix64(seed);
+    s[0] = static_cast<uint32_t>(a);
+    s[1] = static_cast<uint32_t>(a >> 32);
+    s[2] = static_cast<uint32_t>(b);
+    s[3] = static_cast<uint32_t>(b >> 32);
+    hasSpare = false;
+}
+
+Rng::State Rng::getState() const {
+    return {{s[0], s[1], s[2], s[3]}, hasSpare, spare};
+}
+
+void Rng::setState(const State& state) {
+    if ((state.s[0] | state.s[1] | state.s[2] | state.s[3]) == 0) {
+        throw std::invalid_argument("The all-zero generator state is invalid");
+    }
+    for (int i = 0; i < 4; i++) {
+        s[i] = state.s[i];
+    }
+    hasSpare = state.hasSpare;
+    spare = state.spare;
+}
+
+uint32_t Rng::next() {
+    const uint32_t result = s[0] + s[3];
+    const uint32_t t = s[1] << 9;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 11);
+
+    return result;
+}
+
+void Rng::jump() {
+    static const uint32_t JUMP[] = {0x8764000b, 0xf542d2d3, 0x6fa035c3, 0x77f2db5b};
+
+    uint32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (uint32_t word : JUMP) {
+        for (int b = 0; b < 32; b++) {
+            if (word & (1u << b)) {
+                s0 ^= s[0];
+                s1 ^= s[1];
+                s2 ^= s[2];
+                s3 ^= s[3];
+            }
+            next();
+        }
+    }
+    s[0] = s0;
+    s[1] = s1;
+    s[2] = s2;
+    s[3] = s3;
+    hasSpare = false;
+}
+
+float Rng::gaussian(float mean, float stddev) {
+    if (hasSpare) {
+        hasSpare = false;
+        return mean + stddev * spare;
+    }
+
+    hasSpare = true;
+    float u, v, s;
+    do {
+        u = uniform() * 2.0f - 1.0f;
+        v = uniform() * 2.0f - 1.0f;
+        s = u * u + v * v;
+    } while (s >= 1.0f || s == 0.0f);
+
+    s = std::sqrt(-2.0f * std::log(s) / s);
+    spare = v * s;
+    return mean + stddev * u * s;
+}
+
+float Rng::exponential(float lambda) {
+    return -std::log(1.0f - uniform()) / lambda;
+}
+
+void Rng::fillUniform(float* out, int n, float lo, float hi) {
+    const float scale = (hi - lo) * (1.0f / 16777216.0f);
+    for (int i = 0; i < n; i++) {
+        out[i] = lo + (next() >> 8) * scale;
+    }
+}
+
+void Rng::fillGaussian(float* out, int n, float mean, float stddev) {
+    // Box-Muller on pairs: no rejection loop, so the block is branch free
+    const float twoPi = 2.0f * static_cast<float>(M_PI);
+    int i = 0;
+    for (; i + 1 < n; i += 2) {
+        float u1 = 1.0f - uniform(); // (0, 1] keeps the log finite
+        float u2 = uniform();
+        float r = stddev * std::sqrt(-2.0f * std::log(u1));
+        float theta = twoPi * u2;
+        out[i] = mean + r * std::cos(theta);
+        out[i + 1] = mean + r * std::sin(theta);
+    }
+    if (i < n) {
+        out[i] = gaussian(mean, stddev);
+    }
+}
+
+void Rng::fillExponential(float* out, int n, float lambda) {
+    const float invLambda = 1.0f / lambda;
+    for (int i = 0; i < n; i++) {
+        out[i] = -std::log(1.0f - uniform()) * invLambda;
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// xoshiro128+ generator, one instance per Filter so runs are reproducible and filters
+// can be updated from different threads. Block fills let callers draw whole arrays
+// of samples in one call instead of one call per coordinate.
+class Rng {
+public:
+    // Everything that determines the rest of the stream, to checkpoint and restore it
+    struct State {
+        uint32_t s[4];
+        bool hasSpare;
+        float spare;
+    };
+
+private:
+    uint32_t s[4];
+    bool hasSpare = false;
+    float spare = 0.0f;
+
+public:
+    static const uint64_t defaultSeed = 0x5eed;
+
+    explicit Rng(uint64_t seed = defaultSeed);
+    void seed(uint64_t seed);
+    State getState() const;
+    // Throws std::invalid_argument on the all-zero state, which xoshiro never leaves
+    void setState(const State& state);
+
+    uint32_t next();
+    // Advance by 2^64 draws, used to split off independent streams
+    void jump();
+
+    // Uniform in [0, 1)
+    float uniform() { return (next() >> 8) * (1.0f / 16777216.0f); }
+    float gaussian(float mean, float stddev);
+    float exponential(float lambda);
+
+    void fillUniform(float* out, int n, float lo, float hi);
+    void fillGaussian(float* out, int n, float mean, float stddev);
+    void fillExponential(float* out, int n, float lambda);
+};
+
+#endif // RNG_H
@@ -0,0 +1,201 @@
+#include "scenario.h"
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+// Half the side of the box the nodes (and Random anchors) are drawn in
+static const float boxHalfSide = 25.0f;
+
+const char* layoutName(AnchorLayout layout) {
+    switch (layout) {
+    case AnchorLayout::Corner:
+        return "corner";
+    case AnchorLayout::Box:
+        return "box";
+    case AnchorLayout::Random:
+        return "random";
+    }
+    return "unknown";
+}
+
+const char* modeName(FilterMode mode) {
+    switch (mode) {
+    case FilterMode::Baseline:
+        return "baseline";
+    case FilterMode::FastMath:
+        return "fast-math";
+    case FilterMode::Compact:
+        return "compact";
+    case FilterMode::Adaptive:
+        return "adaptive";
+    case FilterMode::CollapseRecovery:
+        return "collapse-recovery";
+    case FilterMode::Multilateration:
+        return "multilateration";
+    }
+    return "unknown";
+}
+
+void configureFilter(Filter& filter, FilterMode mode, int N) {
+    switch (mode) {
+    case FilterMode::Baseline:
+        break;
+    case FilterMode::FastMath:
+        filter.setPrecision(Precision::Fast);
+        break;
+    case FilterMode::Compact:
+        filter.setStorage(ParticleStorage::Fixed16);
+        break;
+    case FilterMode::Adaptive:
+        filter.setAdaptive(true, std::max(1, N / 10), N);
+        break;
+    case FilterMode::CollapseRecovery:
+        filter.setCollapseRecovery(true);
+        break;
+    case FilterMode::Multilateration:
+        filter.setInitMode(InitMode::Multilateration);
+        break;
+    }
+}
+
+static particle randomPosition(Rng& rng) {
+    return {(2 * rng.uniform() - 1) * boxHalfSide, (2 * rng.uniform() - 1) * boxHalfSide,
+            (2 * rng.uniform() - 1) * boxHalfSide, 0.0f};
+}
+
+static std::vector<particle> makeAnchors(AnchorLayout layout, Rng& rng) {
+    std::vector<particle> anchors;
+    switch (layout) {
+    case AnchorLayout::Corner:
+        anchors = {{2, 0.5, -8, 0.0}, {12, 0.5, -8, 0.0}, {12, 14, -8, 0.0}, {12, 0.5, 2, 0.0}};
+        break;
+    case AnchorLayout::Box:
+        for (int corner = 0; corner < 8; corner++) {
+            anchors.push_back({corner & 1 ? boxHalfSide : -boxHalfSide, corner & 2 ? boxHalfSide : -boxHalfSide,
+                               corner & 4 ? boxHalfSide : -boxHalfSide, 0.0f});
+        }
+        break;
+    case AnchorLayout::Random: {
+        int count = 4 + static_cast<int>(rng.next() % 5);
+        for (int i = 0; i < count; i++) {
+            anchors.push_back(randomPosition(rng));
+        }
+        break;
+    }
+    }
+    return anchors;
+}
+
+ScenarioResult runScenario(const ScenarioConfig& config, uint64_t seed) {
+    if (config.N < 1 || config.depth < 0 || config.nodesPerLayer < 1 || config.rounds < 1) {
+        throw std::invalid_argument("A scenario needs N, nodes per layer and rounds of at least 1");
+    }
+    Rng rng(seed);
+    const std::vector<particle> anchors = makeAnchors(config.layout, rng);
+    const float noiseVar = config.noise * config.noise;
+    // the likelihood takes the range noise as the variance of the position ranged to
+    const particle anchorVar = {noiseVar + 0.01f, noiseVar + 0.01f, noiseVar + 0.01f, 0.01f};
+
+    const int layers = config.depth + 1;
+    const int nodes = layers * config.nodesPerLayer;
+    std::vector<particle> truth;
+    std::vector<Filter> filters;
+    filters.reserve(nodes);
+    for (int i = 0; i < nodes; i++) {
+        truth.push_back(randomPosition(rng));
+        filters.emplace_back(config.N, config.modelAntennaDelay, static_cast<unsigned int>(seed * 7919 + i));
+        configureFilter(filters.back(), config.mode, config.N);
+    }
+
+    ScenarioResult result;
+    result.timeToAccuracyNs.assign(nodes, -1.0);
+    result.updatesToAccuracy.assign(nodes, -1);
+    std::vector<double> spentNs(nodes, 0.0);
+    std::vector<int> updates(nodes, 0);
+    auto update = [&](int node, float measurement, particle avg, particle var) {
+        auto start = std::chrono::steady_clock::now();
+        filters[node].estimateState(measurement, 0, avg, var);
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        result.latencyNs.push_back(ns);
+        spentNs[node] += ns;
+        updates[node]++;
+        if (result.updatesToAccuracy[node] < 0 && dist(filters[node].getEstimateAvg(), truth[node]) < config.accuracy) {
+            result.timeToAccuracyNs[node] = spentNs[node];
+            result.updatesToAccuracy[node] = updates[node];
+        }
+    };
+
+    for (int round = 0; round < config.rounds; round++) {
+        for (int layer = 0; layer < layers; layer++) {
+            for (int k = 0; k < config.nodesPerLayer; k++) {
+                const int node = layer * config.nodesPerLayer + k;
+                if (layer == 0) {
+                    for (const particle& anchor : anchors) {
+                        update(node, dist(truth[node], anchor) + rng.gaussian(0.0f, config.noise), anchor, anchorVar);
+                    }
+                    continue;
+                }
+                for (int j = 0; j < config.nodesPerLayer; j++) {
+                    const int neighbour = (layer - 1) * config.nodesPerLayer + j;
+                    if (!filters[neighbour].hasEstimate()) {
+                        continue;
+                    }
+                    particle var = filters[neighbour].getEstimateVar();
+                    var = {var.x + noiseVar, var.y + noiseVar, var.z + noiseVar, var.d};
+                    update(node, dist(truth[node], truth[neighbour]) + rng.gaussian(0.0f, config.noise),
+                           filters[neighbour].getEstimateAvg(), var);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < nodes; i++) {
+        result.finalError.push_back(dist(filters[i].getEstimateAvg(), truth[i]));
+        result.reinitializations += filters[i].getStats().reinitializations;
+    }
+    result.updates = result.latencyNs.size();
+    return result;
+}
+
+std::vector<ScenarioResult> runScenarios(const ScenarioConfig& config, int runs, uint64_t seed, ThreadPool& pool) {
+    std::vector<ScenarioResult> results(runs);
+    pool.parallelFor(runs, [&](int r) { results[r] = runScenario(config, seed + r); });
+    return results;
+}
+
+// Value below which a fraction q of values lies, values is reordered
+static double quantile(std::vector<double>& values, double q) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    size_t k = std::min(values.size() - 1, static_cast<size_t>(q * values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+SweepSummary summarize(const std::vector<ScenarioResult>& results) {
+    SweepSummary summary;
+    std::vector<double> times, counts, latencies;
+    double updates = 0, reinitializations = 0, error = 0;
+    for (const ScenarioResult& result : results) {
+        for (size_t i = 0; i < result.finalError.size(); i++) {
+            summary.nodes++;
+            error += result.finalError[i];
+            if (result.updatesToAccuracy[i] >= 0) {
+                summary.converged++;
+                times.push_back(result.timeToAccuracyNs[i]);
+                counts.push_back(result.updatesToAccuracy[i]);
+            }
+        }
+        latencies.insert(latencies.end(), result.latencyNs.begin(), result.latencyNs.end());
+        updates += result.updates;
+        reinitializations += result.reinitializations;
+    }
+    summary.timeToAccuracyUs = quantile(times, 0.5) / 1000;
+    summary.updatesToAccuracy = quantile(counts, 0.5);
+    summary.reinitRate = updates > 0 ? reinitializations / updates : 0.0;
+    summary.p50LatencyUs = quantile(latencies, 0.5) / 1000;
+    summary.p99LatencyUs = quantile(latencies, 0.99) / 1000;
+    summary.meanFinalError = summary.nodes > 0 ? error / summary.nodes : 0.0;
+    return summary;
+}
@@ -0,0 +1,76 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include <cstdint>
+#include <vector>
+#include "filter.h"
+#include "threadPool.h"
+
+// Randomized end-to-end scenarios for the accuracy / cost sweep (`make sweep`) and the convergence tests.
+// A scenario places layers of nodes at random in a 50 m box around the anchors: the first layer ranges
+// the anchors, every deeper layer ranges the estimates of the layer before it, once per round.
+
+enum class AnchorLayout {
+    Corner, // the four anchors of the unit tests, on one side of the box
+    Box,    // eight anchors on the corners of the box
+    Random  // four to eight anchors drawn in the box with the nodes
+};
+
+// Filter configurations compared by the sweep
+enum class FilterMode { Baseline, FastMath, Compact, Adaptive, CollapseRecovery, Multilateration };
+
+const char* layoutName(AnchorLayout layout);
+const char* modeName(FilterMode mode);
+// Applies mode to a filter of N particles
+void configureFilter(Filter& filter, FilterMode mode, int N);
+
+struct ScenarioConfig {
+    int N = 1000;
+    FilterMode mode = FilterMode::Baseline;
+    AnchorLayout layout = AnchorLayout::Corner;
+    // standard deviation of the range noise, in metres
+    float noise = 0.1f;
+    // relay layers between the anchors and the deepest nodes, 0: every node ranges the anchors
+    int depth = 0;
+    int nodesPerLayer = 4;
+    int rounds = 10;
+    // distance to the truth, in metres, below which a node counts as converged
+    float accuracy = 0.5f;
+    bool modelAntennaDelay = false;
+};
+
+struct ScenarioResult {
+    // per node: its own update time and update count until its error first fell below the accuracy,
+    // -1 if it never did, and its error after the last round
+    std::vector<double> timeToAccuracyNs;
+    std::vector<int> updatesToAccuracy;
+    std::vector<float> finalError;
+    // duration of every estimateState call of the scenario
+    std::vector<double> latencyNs;
+    double updates = 0;
+    // from the filters' statistics, always 0 in a FILTER_STATS=0 build
+    double reinitializations = 0;
+};
+
+// One scenario; the node positions, range noise, Random anchors and filter seeds all derive from seed
+ScenarioResult runScenario(const ScenarioConfig& config, uint64_t seed);
+// runs scenarios of config with seeds seed, seed + 1, ... spread over pool
+std::vector<ScenarioResult> runScenarios(const ScenarioConfig& config, int runs, uint64_t seed, ThreadPool& pool);
+
+// Aggregate of the scenarios of one configuration
+struct SweepSummary {
+    int nodes = 0;
+    int converged = 0;
+    // medians over the converged nodes
+    double timeToAccuracyUs = 0;
+    double updatesToAccuracy = 0;
+    // reinitializations per update, 0 without FILTER_STATS
+    double reinitRate = 0;
+    double p50LatencyUs = 0;
+    double p99LatencyUs = 0;
+    double meanFinalError = 0;
+};
+
+SweepSummary summarize(const std::vector<ScenarioResult>& results);
+
+#endif // SCENARIO_H
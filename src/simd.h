@@ -0,0 +1,200 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Thin wrapper over the vector instruction set available at compile time.
+// Kernels are written once against these functions:
+//   AVX2     -> 8 lanes (native builds with -mavx2 / -march=native)
+//   SSE2     -> 4 lanes (any x86-64 build)
+//   SIMD128  -> 4 lanes (emcc with -msimd128)
+// When none is available FILTER_SIMD_WIDTH is 0 and callers use the scalar path.
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define FILTER_SIMD_WIDTH 8
+#define FILTER_SIMD_NAME "avx2"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FILTER_SIMD_WIDTH 4
+#define FILTER_SIMD_NAME "sse2"
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define FILTER_SIMD_WIDTH 4
+#define FILTER_SIMD_NAME "wasm-simd128"
+#else
+#define FILTER_SIMD_WIDTH 0
+#define FILTER_SIMD_NAME "scalar"
+#endif
+
+#if FILTER_SIMD_WIDTH > 0
+#include <cstdint>
+
+namespace simd {
+
+const int width = FILTER_SIMD_WIDTH;
+
+#if defined(__AVX2__)
+typedef __m256 vfloat;
+typedef __m256i vint;
+
+inline vfloat load(const float* p) { return _mm256_load_ps(p); }
+inline vfloat loadu(const float* p) { return _mm256_loadu_ps(p); }
+// width int16 from 16-byte aligned memory, converted to float
+inline vfloat loadInt16(const int16_t* p) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(p))));
+}
+inline void store(float* p, vfloat a) { _mm256_store_ps(p, a); }
+inline void storeu(float* p, vfloat a) { _mm256_storeu_ps(p, a); }
+inline vfloat set1(float a) { return _mm256_set1_ps(a); }
+inline vfloat add(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+inline vfloat sub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+inline vfloat mul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+inline vfloat div(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+inline vfloat sqrt(vfloat a) { return _mm256_sqrt_ps(a); }
+// ~12 bit estimate of 1/sqrt(a)
+inline vfloat rsqrtEstimate(vfloat a) { return _mm256_rsqrt_ps(a); }
+inline vfloat max(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+inline vfloat min(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+inline vfloat cmpeq(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+inline vfloat cmplt(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+// mask ? a : b
+inline vfloat select(vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, mask); }
+inline vint roundToInt(vfloat a) { return _mm256_cvtps_epi32(a); }
+inline vfloat toFloat(vint a) { return _mm256_cvtepi32_ps(a); }
+// 2^n for integer n in the normal exponent range
+inline vfloat pow2(vint n) {
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23));
+}
+inline float hsum(vfloat a) {
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    return _mm_cvtss_f32(lo);
+}
+
+#elif defined(__SSE2__)
+typedef __m128 vfloat;
+typedef __m128i vint;
+
+inline vfloat load(const float* p) { return _mm_load_ps(p); }
+inline vfloat loadu(const float* p) { return _mm_loadu_ps(p); }
+inline vfloat loadInt16(const int16_t* p) {
+    __m128i q = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+    // sign-extend by placing each int16 in the high half of a lane and shifting it down
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(q, q), 16));
+}
+inline void store(float* p, vfloat a) { _mm_store_ps(p, a); }
+inline void storeu(float* p, vfloat a) { _mm_storeu_ps(p, a); }
+inline vfloat set1(float a) { return _mm_set1_ps(a); }
+inline vfloat add(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+inline vfloat sub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+inline vfloat mul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+inline vfloat div(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+inline vfloat sqrt(vfloat a) { return _mm_sqrt_ps(a); }
+inline vfloat rsqrtEstimate(vfloat a) { return _mm_rsqrt_ps(a); }
+inline vfloat max(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+inline vfloat min(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+inline vfloat cmpeq(vfloat a, vfloat b) { return _mm_cmpeq_ps(a, b); }
+inline vfloat cmplt(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+inline vfloat select(vfloat mask, vfloat a, vfloat b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+inline vint roundToInt(vfloat a) { return _mm_cvtps_epi32(a); }
+inline vfloat toFloat(vint a) { return _mm_cvtepi32_ps(a); }
+inline vfloat pow2(vint n) {
+    return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23));
+}
+inline float hsum(vfloat a) {
+    a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+    a = _mm_add_ss(a, _mm_shuffle_ps(a, a, 1));
+    return _mm_cvtss_f32(a);
+}
+
+#elif defined(__wasm_simd128__)
+typedef v128_t vfloat;
+typedef v128_t vint;
+
+inline vfloat load(const float* p) { return wasm_v128_load(p); }
+inline vfloat loadu(const float* p) { return wasm_v128_load(p); }
+inline vfloat loadInt16(const int16_t* p) { return wasm_f32x4_convert_i32x4(wasm_i32x4_load16x4(p)); }
+inline void store(float* p, vfloat a) { wasm_v128_store(p, a); }
+inline void storeu(float* p, vfloat a) { wasm_v128_store(p, a); }
+inline vfloat set1(float a) { return wasm_f32x4_splat(a); }
+inline vfloat add(vfloat a, vfloat b) { return wasm_f32x4_add(a, b); }
+inline vfloat sub(vfloat a, vfloat b) { return wasm_f32x4_sub(a, b); }
+inline vfloat mul(vfloat a, vfloat b) { return wasm_f32x4_mul(a, b); }
+inline vfloat div(vfloat a, vfloat b) { return wasm_f32x4_div(a, b); }
+inline vfloat sqrt(vfloat a) { return wasm_f32x4_sqrt(a); }
+// no estimate instruction in SIMD128, the refinement below is then exact to rounding
+inline vfloat rsqrtEstimate(vfloat a) { return wasm_f32x4_div(wasm_f32x4_splat(1.0f), wasm_f32x4_sqrt(a)); }
+inline vfloat max(vfloat a, vfloat b) { return wasm_f32x4_pmax(a, b); }
+inline vfloat min(vfloat a, vfloat b) { return wasm_f32x4_pmin(a, b); }
+inline vfloat cmpeq(vfloat a, vfloat b) { return wasm_f32x4_eq(a, b); }
+inline vfloat cmplt(vfloat a, vfloat b) { return wasm_f32x4_lt(a, b); }
+inline vfloat select(vfloat mask, vfloat a, vfloat b) { return wasm_v128_bitselect(a, b, mask); }
+inline vint roundToInt(vfloat a) { return wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_nearest(a)); }
+inline vfloat toFloat(vint a) { return wasm_f32x4_convert_i32x4(a); }
+inline vfloat pow2(vint n) {
+    return wasm_i32x4_shl(wasm_i32x4_add(n, wasm_i32x4_splat(127)), 23);
+}
+inline float hsum(vfloat a) {
+    return wasm_f32x4_extract_lane(a, 0) + wasm_f32x4_extract_lane(a, 1) +
+           wasm_f32x4_extract_lane(a, 2) + wasm_f32x4_extract_lane(a, 3);
+}
+#endif
+
+inline vfloat abs(vfloat a) { return max(a, sub(set1(0.0f), a)); }
+
+// Cephes-style single precision exp, ~1 ulp over the normal range.
+// Inputs below the smallest normal result flush to 0 like std::exp's underflow.
+inline vfloat exp(vfloat x) {
+    const vfloat hi = set1(88.0f);
+    const vfloat lo = set1(-87.3365447505531f);
+    vfloat underflow = cmplt(x, lo);
+    x = min(max(x, lo), hi);
+
+    vint n = roundToInt(mul(x, set1(1.44269504088896341f)));
+    vfloat fn = toFloat(n);
+    x = sub(x, mul(fn, set1(0.693359375f)));
+    x = sub(x, mul(fn, set1(-2.12194440e-4f)));
+
+    vfloat y = set1(1.9875691500e-4f);
+    y = add(mul(y, x), set1(1.3981999507e-3f));
+    y = add(mul(y, x), set1(8.3334519073e-3f));
+    y = add(mul(y, x), set1(4.1665795894e-2f));
+    y = add(mul(y, x), set1(1.6666665459e-1f));
+    y = add(mul(y, x), set1(5.0000001201e-1f));
+    y = add(mul(mul(y, x), x), add(x, set1(1.0f)));
+
+    return select(underflow, set1(0.0f), mul(y, pow2(n)));
+}
+
+// 1/sqrt(a) for positive a, the estimate refined by one Newton step (~1e-7 relative error)
+inline vfloat rsqrt(vfloat a) {
+    vfloat y = rsqrtEstimate(a);
+    return mul(y, sub(set1(1.5f), mul(mul(set1(0.5f), a), mul(y, y))));
+}
+
+// Cheaper exp: same range reduction with a degree 4 polynomial, ~5e-5 relative error
+inline vfloat expFast(vfloat x) {
+    const vfloat hi = set1(88.0f);
+    const vfloat lo = set1(-87.3365447505531f);
+    vfloat underflow = cmplt(x, lo);
+    x = min(max(x, lo), hi);
+
+    vint n = roundToInt(mul(x, set1(1.44269504088896341f)));
+    vfloat fn = toFloat(n);
+    x = sub(x, mul(fn, set1(0.693359375f)));
+    x = sub(x, mul(fn, set1(-2.12194440e-4f)));
+
+    vfloat y = set1(4.1666666667e-2f);
+    y = add(mul(y, x), set1(1.6666666667e-1f));
+    y = add(mul(y, x), set1(5.0e-1f));
+    y = add(mul(mul(y, x), x), add(x, set1(1.0f)));
+
+    return select(underflow, set1(0.0f), mul(y, pow2(n)));
+}
+
+} // namespace simd
+#endif
+
+#endif // SIMD_H
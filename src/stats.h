@@ -0,0 +1,63 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+
+// Hot-path counters are on unless built with -DFILTER_STATS=0, which compiles every
+// FILTER_STAT(...) statement out; getStats() then reports zeros.
+#ifndef FILTER_STATS
+#define FILTER_STATS 1
+#endif
+
+#if FILTER_STATS
+#define FILTER_STAT(statement) statement
+#else
+#define FILTER_STAT(statement)
+#endif
+
+// Cumulative per-phase timings and counters of one Filter.
+// Counts are doubles so they cross into JavaScript as plain numbers without overflowing an int.
+struct FilterStats {
+    // nanoseconds spent per phase; the phases do not overlap, and init and resample include the
+    // estimate they compute on the way, so estimateNs only covers updates that keep the weights
+    double initNs = 0;
+    double weightingNs = 0;
+    double resampleNs = 0;
+    double estimateNs = 0;
+    // updates after initialization, reinitializations triggered by the weight sum, resamples done
+    double updates = 0;
+    double reinitializations = 0;
+    double resamples = 0;
+    // initializations drawn from the multilateration proposal rather than the sphere
+    double proposals = 0;
+    // updates whose evidence fell below the reinitialization threshold, and those recovered without
+    // reinitializing by re-injecting reinjectedParticles fresh particles in total
+    double collapses = 0;
+    double reinjections = 0;
+    double reinjectedParticles = 0;
+    // resampled particles that repeat the one before them (the repcounter runs), and the longest run
+    double duplicates = 0;
+    double longestRun = 0;
+    // effective sample size of the last update
+    float lastESS = 0;
+};
+
+// Adds the time from construction to stop() or destruction to a phase total
+class PhaseTimer {
+private:
+    std::chrono::steady_clock::time_point start;
+    double* total;
+
+public:
+    explicit PhaseTimer(double& total) : start(std::chrono::steady_clock::now()), total(&total) {}
+    ~PhaseTimer() { stop(); }
+
+    void stop() {
+        if (total) {
+            *total += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            total = nullptr;
+        }
+    }
+};
+
+#endif // STATS_H
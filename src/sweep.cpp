@@ -0,0 +1,168 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "scenario.h"
+
+// Accuracy vs cost sweep over randomized scenarios, built and run with `make sweep`:
+//   ./sweep [--n N,...] [--mode M,...] [--layout L,...] [--noise S,...] [--depth D,...]
+//           [--runs R] [--rounds K] [--accuracy A] [--seed S] [--threads T] [--out sweep.csv]
+// Every combination of N, mode, layout, noise and depth runs R scenarios and adds one summary line to
+// the CSV, see analyze/sweepPareto.py. The scenarios run on one thread by default, so the latencies are
+// those of an unloaded core; T threads (0: every hardware thread) finish sooner, but then every timed
+// update shares the machine with T - 1 others and the latency columns include that contention.
+
+// the reinitialization rate comes from the filters' statistics counters
+#if !FILTER_STATS
+#error "sweep reports reinitializations per update and needs FILTER_STATS"
+#endif
+
+static const FilterMode allModes[] = {FilterMode::Baseline, FilterMode::FastMath,         FilterMode::Compact,
+                                      FilterMode::Adaptive, FilterMode::CollapseRecovery, FilterMode::Multilateration};
+static const AnchorLayout allLayouts[] = {AnchorLayout::Corner, AnchorLayout::Box, AnchorLayout::Random};
+
+static void usage() {
+    std::cerr << "usage: sweep [--n N,...] [--mode M,...] [--layout L,...] [--noise S,...] [--depth D,...]\n"
+                 "             [--runs R] [--rounds K] [--accuracy A] [--seed S] [--threads T] [--out path]\n"
+                 "modes: baseline fast-math compact adaptive collapse-recovery multilateration\n"
+                 "layouts: corner box random"
+              << std::endl;
+}
+
+static std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+// Parses a comma separated list of names into values, false on an unknown name
+template <typename T, size_t K>
+static bool parseNames(const std::string& list, const T (&all)[K], const char* (*name)(T), std::vector<T>* out) {
+    out->clear();
+    for (const std::string& item : splitList(list)) {
+        bool found = false;
+        for (T value : all) {
+            if (item == name(value)) {
+                out->push_back(value);
+                found = true;
+            }
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    return !out->empty();
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> Ns = {250, 1000, 4000};
+    std::vector<FilterMode> modes(std::begin(allModes), std::end(allModes));
+    std::vector<AnchorLayout> layouts = {AnchorLayout::Corner};
+    std::vector<float> noises = {0.1f};
+    std::vector<int> depths = {0};
+    ScenarioConfig base;
+    int runs = 20;
+    uint64_t seed = Rng::defaultSeed;
+    int threads = 1;
+    std::string out = "sweep.csv";
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        bool valid = hasValue;
+        if (arg == "--n" && hasValue) {
+            Ns.clear();
+            for (const std::string& item : splitList(argv[++i])) {
+                Ns.push_back(std::atoi(item.c_str()));
+            }
+        } else if (arg == "--mode" && hasValue) {
+            valid = parseNames(argv[++i], allModes, modeName, &modes);
+        } else if (arg == "--layout" && hasValue) {
+            valid = parseNames(argv[++i], allLayouts, layoutName, &layouts);
+        } else if (arg == "--noise" && hasValue) {
+            noises.clear();
+            for (const std::string& item : splitList(argv[++i])) {
+                noises.push_back(std::atof(item.c_str()));
+            }
+        } else if (arg == "--depth" && hasValue) {
+            depths.clear();
+            for (const std::string& item : splitList(argv[++i])) {
+                depths.push_back(std::atoi(item.c_str()));
+            }
+        } else if (arg == "--runs" && hasValue) {
+            runs = std::atoi(argv[++i]);
+        } else if (arg == "--rounds" && hasValue) {
+            base.rounds = std::atoi(argv[++i]);
+        } else if (arg == "--accuracy" && hasValue) {
+            base.accuracy = std::atof(argv[++i]);
+        } else if (arg == "--seed" && hasValue) {
+            seed = std::strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "--threads" && hasValue) {
+            threads = std::atoi(argv[++i]);
+        } else if (arg == "--out" && hasValue) {
+            out = argv[++i];
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            usage();
+            return 2;
+        }
+    }
+    if (Ns.empty() || noises.empty() || depths.empty() || runs < 1) {
+        usage();
+        return 2;
+    }
+
+    std::ofstream csv(out);
+    if (!csv) {
+        std::cerr << "Cannot open " << out << std::endl;
+        return 1;
+    }
+    csv << "N,mode,layout,noise,depth,runs,nodes,converged,timeToAccuracyUs,updatesToAccuracy,reinitRate,"
+           "p50LatencyUs,p99LatencyUs,meanFinalError\n";
+    ThreadPool pool(threads);
+    if (pool.size() > 1) {
+        std::cerr << "timing on " << pool.size() << " threads: the latencies include the load of the other scenarios"
+                  << std::endl;
+    }
+    try {
+        for (int N : Ns) {
+            for (FilterMode mode : modes) {
+                for (AnchorLayout layout : layouts) {
+                    for (float noise : noises) {
+                        for (int depth : depths) {
+                            ScenarioConfig config = base;
+                            config.N = N;
+                            config.mode = mode;
+                            config.layout = layout;
+                            config.noise = noise;
+                            config.depth = depth;
+                            // the same seeds for every configuration, so they see the same scenarios
+                            SweepSummary s = summarize(runScenarios(config, runs, seed, pool));
+                            csv << N << "," << modeName(mode) << "," << layoutName(layout) << "," << noise << ","
+                                << depth << "," << runs << "," << s.nodes << "," << s.converged << ","
+                                << s.timeToAccuracyUs << "," << s.updatesToAccuracy << "," << s.reinitRate << ","
+                                << s.p50LatencyUs << "," << s.p99LatencyUs << "," << s.meanFinalError << "\n";
+                            std::cout << "N " << N << " " << modeName(mode) << " " << layoutName(layout) << " noise "
+                                      << noise << " depth " << depth << ": " << s.converged << "/" << s.nodes
+                                      << " converged, p50 " << s.p50LatencyUs << " us, error " << s.meanFinalError
+                                      << " m" << std::endl;
+                        }
+                    }
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
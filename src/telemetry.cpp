@@ -0,0 +1,152 @@
+#include "telemetry.h"
+#include "byteio.h"
+#include <chrono>
+#include <cinttypes>
+#include <cstring>
+#include <stdexcept>
+
+static const unsigned char telemetryMagic[4] = {'P', 'F', 'T', 'M'};
+
+static void putParticle(unsigned char* out, particle p) {
+    putF32(out, p.x);
+    putF32(out + 4, p.y);
+    putF32(out + 8, p.z);
+    putF32(out + 12, p.d);
+}
+
+TelemetryRing::TelemetryRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    slots.resize(size);
+    mask = size - 1;
+}
+
+bool TelemetryRing::push(const TelemetryRecord& record) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == slots.size()) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    slots[t & mask] = record;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+bool TelemetryRing::pop(TelemetryRecord* record) {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+        return false;
+    }
+    *record = slots[h & mask];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+TelemetryDrain::TelemetryDrain(const std::string& path, TelemetryFormat format, int intervalMs)
+    : file(std::fopen(path.c_str(), format == TelemetryFormat::Binary ? "wb" : "w")), format(format),
+      intervalMs(intervalMs) {
+    if (!file) {
+        throw std::runtime_error("Cannot open telemetry file " + path);
+    }
+    if (format == TelemetryFormat::Binary) {
+        unsigned char header[telemetryHeaderSize];
+        std::memcpy(header, telemetryMagic, 4);
+        putU32(header + 4, telemetryVersion);
+        putU32(header + 8, telemetryRecordSize);
+        putU32(header + 12, 0);
+        std::fwrite(header, 1, telemetryHeaderSize, file);
+    } else {
+        std::fputs("node,measurements,timestampNs,x,y,z,d,varx,vary,varz,vard,"
+                   "initNs,weightingNs,resampleNs,estimateNs\n",
+                   file);
+    }
+#if FILTER_THREADS
+    worker = std::thread(&TelemetryDrain::workerLoop, this);
+#endif
+}
+
+TelemetryDrain::~TelemetryDrain() {
+    stop();
+    std::fclose(file);
+}
+
+std::shared_ptr<TelemetryRing> TelemetryDrain::addRing(size_t capacity) {
+    auto ring = std::make_shared<TelemetryRing>(capacity);
+    std::lock_guard<std::mutex> guard(ringsLock);
+    rings.push_back(ring);
+    return ring;
+}
+
+void TelemetryDrain::write(const TelemetryRecord& r) {
+    if (format == TelemetryFormat::Binary) {
+        unsigned char out[telemetryRecordSize];
+        putU32(out, r.node);
+        putU32(out + 4, r.measurements);
+        putU32(out + 8, static_cast<uint32_t>(r.timestampNs));
+        putU32(out + 12, static_cast<uint32_t>(r.timestampNs >> 32));
+        putParticle(out + 16, r.avg);
+        putParticle(out + 32, r.var);
+        putF32(out + 48, r.initNs);
+        putF32(out + 52, r.weightingNs);
+        putF32(out + 56, r.resampleNs);
+        putF32(out + 60, r.estimateNs);
+        std::fwrite(out, 1, telemetryRecordSize, file);
+    } else {
+        std::fprintf(file, "%" PRIu32 ",%" PRIu32 ",%" PRIu64 ",%g,%g,%g,%g,%g,%g,%g,%g,%g,%g,%g,%g\n", r.node,
+                     r.measurements, r.timestampNs, r.avg.x, r.avg.y, r.avg.z, r.avg.d, r.var.x, r.var.y, r.var.z,
+                     r.var.d, r.initNs, r.weightingNs, r.resampleNs, r.estimateNs);
+    }
+}
+
+size_t TelemetryDrain::drain() {
+    std::lock_guard<std::mutex> consumer(consumerLock);
+    std::vector<std::shared_ptr<TelemetryRing>> current;
+    {
+        std::lock_guard<std::mutex> guard(ringsLock);
+        current = rings;
+    }
+    size_t count = 0;
+    TelemetryRecord record;
+    for (const auto& ring : current) {
+        while (ring->pop(&record)) {
+            write(record);
+            count++;
+        }
+    }
+    std::fflush(file);
+    written.fetch_add(count, std::memory_order_relaxed);
+    return count;
+}
+
+void TelemetryDrain::workerLoop() {
+    std::unique_lock<std::mutex> guard(stopLock);
+    while (!stopping) {
+        wake.wait_for(guard, std::chrono::milliseconds(intervalMs));
+        guard.unlock();
+        drain();
+        guard.lock();
+    }
+}
+
+void TelemetryDrain::stop() {
+    {
+        std::lock_guard<std::mutex> guard(stopLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+    drain();
+}
+
+uint64_t TelemetryDrain::getDropped() {
+    std::lock_guard<std::mutex> guard(ringsLock);
+    uint64_t total = 0;
+    for (const auto& ring : rings) {
+        total += ring->getDropped();
+    }
+    return total;
+}
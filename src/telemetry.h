@@ -0,0 +1,115 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "particles.h"
+#include "threadPool.h"
+
+// Estimate of one node after one update, pushed by Filter::setTelemetry
+struct TelemetryRecord {
+    uint32_t node;
+    // measurements of the update, 1 for estimateState
+    uint32_t measurements;
+    // steady clock nanoseconds at the end of the update
+    uint64_t timestampNs;
+    particle avg;
+    particle var;
+    // nanoseconds spent by the update in each phase, as in FilterStats
+    float initNs;
+    float weightingNs;
+    float resampleNs;
+    float estimateNs;
+};
+
+// Binary telemetry file: a 16-byte header followed by fixed 64-byte records, little-endian.
+//   header: "PFTM", uint32 version, uint32 record size, uint32 reserved (0)
+//   record: uint32 node, uint32 measurements, uint32 timestamp low, uint32 timestamp high,
+//           float avg x/y/z/d, float var x/y/z/d, float initNs, weightingNs, resampleNs, estimateNs
+// The CSV format has one line per record with the same fields, under a header line.
+const uint32_t telemetryVersion = 1;
+const int telemetryHeaderSize = 16;
+const int telemetryRecordSize = 64;
+
+enum class TelemetryFormat { Binary, Csv };
+
+// Bounded single-producer single-consumer queue of records. push and pop never lock or allocate:
+// each side owns one index and publishes it with release stores. A push onto a full ring drops the
+// record and counts it instead of waiting for the consumer.
+class TelemetryRing {
+private:
+    std::vector<TelemetryRecord> slots;
+    size_t mask;
+    // written by the consumer and the producer respectively, on separate cache lines
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    std::atomic<uint64_t> dropped{0};
+
+public:
+    // capacity is rounded up to a power of two
+    explicit TelemetryRing(size_t capacity);
+    TelemetryRing(const TelemetryRing&) = delete;
+    TelemetryRing& operator=(const TelemetryRing&) = delete;
+
+    // Producer side, returns false and counts a drop when the ring is full
+    bool push(const TelemetryRecord& record);
+    // Consumer side, returns false when the ring is empty
+    bool pop(TelemetryRecord* record);
+
+    size_t capacity() const { return slots.size(); }
+    uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+};
+
+// Consumer of any number of rings, one per producing thread, writing their records to one file.
+// A background thread drains the rings every interval; without thread support drain() has to be
+// called by the owner. The file is complete once the drain is stopped or destroyed.
+class TelemetryDrain {
+private:
+    std::FILE* file;
+    TelemetryFormat format;
+    int intervalMs;
+
+    std::mutex ringsLock;
+    std::vector<std::shared_ptr<TelemetryRing>> rings;
+    // serializes drain() between the background thread and the owner, the producers never take it
+    std::mutex consumerLock;
+    std::atomic<uint64_t> written{0};
+
+    std::mutex stopLock;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread worker;
+
+    void write(const TelemetryRecord& record);
+    void workerLoop();
+
+public:
+    // Truncates path and writes the header, throws std::runtime_error if it cannot be opened
+    explicit TelemetryDrain(const std::string& path, TelemetryFormat format = TelemetryFormat::Binary,
+                            int intervalMs = 10);
+    // Stops, drains what is left and closes the file
+    ~TelemetryDrain();
+    TelemetryDrain(const TelemetryDrain&) = delete;
+    TelemetryDrain& operator=(const TelemetryDrain&) = delete;
+
+    // New ring drained into this file, to be pushed to by a single thread
+    std::shared_ptr<TelemetryRing> addRing(size_t capacity = 4096);
+    // Writes everything the rings hold now and flushes the file, returns the number of records written
+    size_t drain();
+    // Stops the background thread after a last drain; the rings can still be drained by hand
+    void stop();
+
+    uint64_t getWritten() const { return written.load(std::memory_order_relaxed); }
+    // Records dropped by full rings, over every ring
+    uint64_t getDropped();
+};
+
+#endif // TELEMETRY_H
@@ -2,7 +2,20 @@
 #include <fstream>
 #include <chrono>
 #include <sys/resource.h> // For memory usage
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
 #include "filter.h"
+#include "kernels.h"
+#include "filterBank.h"
+#include "basicFilter.h"
+#include "trace.h"
+#include "asyncFilter.h"
+#include "meshScheduler.h"
+#include "telemetry.h"
+#include "byteio.h"
+#include "scenario.h"
 
 // Helper function to get current memory usage in kilobytes
 size_t getMemoryUsage() {
@@ -11,6 +24,66 @@ size_t getMemoryUsage() {
     return usage.ru_maxrss; // Memory usage in KB
 }
 
+// Allocation-counting hook: every global operator new in the test binary bumps this counter
+static std::atomic<long> allocationCount{0};
+
+// Every replacement new allocates with the C allocator and every replacement delete frees with it. The
+// calls go through these out-of-line helpers, so inlining a delete next to a new does not trip
+// -Wmismatched-new-delete.
+__attribute__((noinline)) static void* countedAllocate(std::size_t size, std::size_t alignment) {
+    allocationCount++;
+    void* p;
+    if (alignment <= alignof(std::max_align_t)) {
+        p = std::malloc(size ? size : 1);
+    } else {
+        // aligned_alloc wants a multiple of the alignment
+        p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment + (size == 0 ? alignment : 0));
+    }
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) static void countedFree(void* p) noexcept { std::free(p); }
+
+void* operator new(std::size_t size) { return countedAllocate(size, 0); }
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return countedAllocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* p) noexcept { countedFree(p); }
+void operator delete(void* p, std::size_t) noexcept { countedFree(p); }
+void operator delete(void* p, std::align_val_t) noexcept { countedFree(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { countedFree(p); }
+
+// The node and corner anchors of ConvergenceAnchors, which most tests range
+static const particle cornerNode{-10, 0.5, 10, 0.0};
+static const std::vector<particle> cornerAnchors = {{2, 0.5, -8, 0.0}, {12, 0.5, -8, 0.0}, {12, 14, -8, 0.0},
+                                                    {12, 0.5, 2, 0.0}};
+static const particle cornerVars{0.1, 0.1, 0.1, 0.1};
+// The nodes of EstimateGeometry
+static const std::vector<particle> meshNodes = {{-5, -3, 2, 0.0}, {-10, 1.0, 12, 0.0}, {-14, 10, 18, 0.0},
+                                                {-20, 0.5, 32, 0.0}};
+
+// Rounds of exact ranges from node to each corner anchor in turn
+static void rangeCorners(Filter& filter, int rounds, particle node = cornerNode) {
+    for (int round = 0; round < rounds; round++) {
+        for (const particle& anchor : cornerAnchors) {
+            filter.estimateState(dist(node, anchor), 0, anchor, cornerVars);
+        }
+    }
+}
+
+// One bank round of the ranges from the first count mesh nodes to each corner anchor
+static std::vector<BankJob> cornerJobs(int count) {
+    std::vector<BankJob> jobs;
+    for (int i = 0; i < count; i++) {
+        for (const particle& anchor : cornerAnchors) {
+            jobs.push_back({i, dist(meshNodes[i], anchor), -1, anchor, cornerVars});
+        }
+    }
+    return jobs;
+}
+
 // Original tests
 TEST(FilterTest, Constructor) {
     Filter filter(5);
@@ -92,30 +165,715 @@ TEST(FilterTest, EstimateState) {
 
 }
 
-// TEST(FilterTest, RandomizedConvergence){
-//     particle anchor0{ 2, 0.5, -8, 0.0, 0.01 };
-//     particle anchor1{ 12, 0.5, -8, 0.0, 0.01 };
-//     particle anchor2{ 12, 14, -8, 0.0, 0.01 };
-//     particle anchor3{ 12, 0.5, 2, 0.0, 0.01 };
-//     std::vector<particle> anchors = {anchor0, anchor1, anchor2, anchor3};
-//     for(int i=0; i<50;i++){
-//         Filter test(1000, false);
-//         particle randPos{static_cast<float>(static_cast<float>(rand()) / RAND_MAX * 50.0f - 25.0f), static_cast<float>(static_cast<float>(rand()) / RAND_MAX * 50.0f - 25.0f), static_cast<float>(static_cast<float>(rand()) / RAND_MAX * 50.0f - 25.0f), 0.0f, 0.01f};
-//         int estimationRounds = 20;
-//         for(int j = 0; j<estimationRounds;j++){
-//             for(auto anchor: anchors){
-//                 test.estimateState(dist(randPos, anchor), anchor);
-//             }
-//         }
-//         particle estimate = test.getEstimate();
-//         // std::cout << "Estimated position after "<<estimationRounds<<" updates: (" << estimate.x << ", " << estimate.y << ", " << estimate.z << ", " << estimate.d << ", "<< estimate.w<<")" << std::endl;
-//         // std::cout << "Estimated distance after "<<estimationRounds<<" updates: " << dist(estimate, randPos) <<" with variance: "<< estimate.w <<std::endl;
-//         //  check that the estimated position is close to the true position
-//         EXPECT_NEAR(estimate.x, randPos.x, 1.5);
-//         EXPECT_NEAR(estimate.y, randPos.y, 1.5);
-//         EXPECT_NEAR(estimate.z, randPos.z, 1.5);
-//     }
-// }
+TEST(FilterTest, SimdWeightsMatchScalar) {
+    // odd size so the padded tail block is exercised, first particle sits on the anchor
+    const int n = 1003;
+    ParticleSet particles;
+    particles.resize(n);
+    particle anchor = {2.0, 0.5, -8.0, 0.02};
+    particles.set(0, anchor);
+    for (int i = 1; i < n; i++) {
+        particles.set(i, {anchor.x + (i % 37) * 0.7f - 12.0f, anchor.y + (i % 11) * 1.3f - 7.0f,
+                          anchor.z + (i % 23) * 0.9f - 10.0f, (i % 7) * 0.01f});
+    }
+    particle anchorVar = {0.1, 0.2, 0.3, 0.1};
+    std::vector<float> scalarWeights(n), simdWeights(n);
+    for (bool modelDelay : {false, true}) {
+        float scalarSum = computeWeightsScalar(particles, 9.0f, anchor, anchorVar, modelDelay, scalarWeights.data());
+        float simdSum = computeWeightsSimd(particles, 9.0f, anchor, anchorVar, modelDelay, simdWeights.data());
+        for (int i = 0; i < n; i++) {
+            EXPECT_NEAR(simdWeights[i], scalarWeights[i], 1e-5f + 1e-4f * scalarWeights[i]) << "particle " << i;
+        }
+        EXPECT_NEAR(simdSum, scalarSum, 1e-4f * scalarSum);
+    }
+    std::cout << "SIMD backend: " << simdBackend() << std::endl;
+}
+
+TEST(FilterTest, BatchWeightsMatchScalar) {
+    const int n = 517;
+    ParticleSet particles;
+    particles.resize(n);
+    for (int i = 0; i < n; i++) {
+        particles.set(i, {(i % 29) * 0.5f - 7.0f, (i % 13) * 0.8f - 5.0f, (i % 17) * 0.6f - 5.0f, (i % 5) * 0.01f});
+    }
+    // more anchors than fit in one kernel chunk
+    std::vector<float> measurements;
+    std::vector<particle> anchorAvgs, anchorVars;
+    for (int j = 0; j < 20; j++) {
+        particle anchor = {10.0f * (j % 3), 5.0f * (j % 4), -3.0f * (j % 5), 0.0f};
+        anchorAvgs.push_back(anchor);
+        anchorVars.push_back({0.5f + j, 0.5f + j, 0.5f + j, 0.1f});
+        measurements.push_back(dist(anchor, {0, 0, 0, 0}));
+    }
+    std::vector<float> scalarWeights(n), simdWeights(n);
+    for (int k : {1, 4, 20}) {
+        float scalarSum = computeWeightsBatchScalar(particles, measurements.data(), anchorAvgs.data(), anchorVars.data(),
+                                                    k, false, scalarWeights.data());
+        float simdSum = computeWeightsBatchSimd(particles, measurements.data(), anchorAvgs.data(), anchorVars.data(),
+                                                k, false, simdWeights.data());
+        for (int i = 0; i < n; i++) {
+            EXPECT_NEAR(simdWeights[i], scalarWeights[i], 1e-6f + 1e-3f * scalarWeights[i]) << "k " << k << " particle " << i;
+        }
+        EXPECT_NEAR(simdSum, scalarSum, 1e-3f * scalarSum + 1e-6f);
+    }
+}
+
+TEST(FilterTest, FastMathErrorIsBounded) {
+    float maxSinCosError = 0.0f;
+    for (int i = 0; i <= 100000; i++) {
+        float angle = i * (2.0f * M_PI / 100000);
+        float s, c;
+        FastMath::sincos(angle, &s, &c);
+        maxSinCosError = std::max(maxSinCosError, std::fabs(s - std::sin(angle)));
+        maxSinCosError = std::max(maxSinCosError, std::fabs(c - std::cos(angle)));
+    }
+    EXPECT_LT(maxSinCosError, 1e-6f);
+
+#if FILTER_SIMD_WIDTH > 0
+    alignas(AlignedArray::alignment) float in[simd::width], out[simd::width], root[simd::width];
+    float maxExpError = 0.0f, maxRootError = 0.0f, maxInverseError = 0.0f;
+    for (int i = 0; i < 20000; i++) {
+        for (int j = 0; j < simd::width; j++) {
+            in[j] = -87.0f + (i * simd::width + j) * (95.0f / (20000 * simd::width));
+        }
+        simd::store(out, FastMath::exp(simd::load(in)));
+        for (int j = 0; j < simd::width; j++) {
+            maxExpError = std::max(maxExpError, std::fabs(out[j] / std::exp(in[j]) - 1.0f));
+        }
+        for (int j = 0; j < simd::width; j++) {
+            in[j] = 1e-6f + (i * simd::width + j) * 0.01f;
+        }
+        simd::vfloat r, inverse;
+        FastMath::rootAndInverse(simd::load(in), &r, &inverse);
+        simd::store(root, r);
+        simd::store(out, inverse);
+        for (int j = 0; j < simd::width; j++) {
+            maxRootError = std::max(maxRootError, std::fabs(root[j] / std::sqrt(in[j]) - 1.0f));
+            maxInverseError = std::max(maxInverseError, std::fabs(out[j] * in[j] - 1.0f));
+        }
+    }
+    EXPECT_LT(maxExpError, 1e-4f);
+    EXPECT_LT(maxRootError, 1e-5f);
+    EXPECT_LT(maxInverseError, 1e-5f);
+#endif
+
+    // fast weights against the scalar reference
+    const int n = 1003;
+    ParticleSet particles;
+    particles.resize(n);
+    particle anchor = {2.0, 0.5, -8.0, 0.02};
+    for (int i = 0; i < n; i++) {
+        particles.set(i, {anchor.x + (i % 37) * 0.7f - 12.0f, anchor.y + (i % 11) * 1.3f - 7.0f,
+                          anchor.z + (i % 23) * 0.9f - 10.0f, (i % 7) * 0.01f});
+    }
+    particle anchorVar = {0.1, 0.2, 0.3, 0.1};
+    std::vector<float> scalarWeights(n), fastWeights(n);
+    float scalarSum = computeWeightsScalar(particles, 9.0f, anchor, anchorVar, true, scalarWeights.data());
+    float fastSum = computeWeightsSimd(particles, 9.0f, anchor, anchorVar, true, fastWeights.data(), Precision::Fast);
+    for (int i = 0; i < n; i++) {
+        EXPECT_NEAR(fastWeights[i], scalarWeights[i], 1e-5f + 1e-3f * scalarWeights[i]) << "particle " << i;
+    }
+    EXPECT_NEAR(fastSum, scalarSum, 1e-3f * scalarSum);
+
+    // and a fast filter converges like an exact one
+    Filter filter(2000, false);
+    filter.setPrecision(Precision::Fast);
+    EXPECT_EQ(filter.getPrecision(), Precision::Fast);
+    rangeCorners(filter, 3);
+    EXPECT_NEAR(dist(filter.getEstimateAvg(), cornerNode), 0.0, 1.0);
+}
+
+TEST(FilterTest, MomentsAreStableAtLargeN) {
+    // a tight cloud far from the origin, where float sums of x and x^2 lose the variance
+    const int n = 200000;
+    ParticleSet particles;
+    particles.resize(n);
+    std::vector<float> weights(n);
+    double weightSum = 0.0;
+    for (int i = 0; i < n; i++) {
+        particles.set(i, {1000.0f + (i % 101) * 0.01f, -500.0f + (i % 53) * 0.02f, 250.0f, 0.1f});
+        weights[i] = 1.0f + (i % 3);
+        weightSum += weights[i];
+    }
+    for (int i = 0; i < n; i++) {
+        weights[i] /= weightSum;
+    }
+
+    for (bool weighted : {false, true}) {
+        double mean[2] = {0, 0}, var[2] = {0, 0}, total = 0;
+        for (int i = 0; i < n; i++) {
+            double w = weighted ? weights[i] : 1.0;
+            mean[0] += w * particles.x[i];
+            mean[1] += w * particles.y[i];
+            total += w;
+        }
+        mean[0] /= total;
+        mean[1] /= total;
+        for (int i = 0; i < n; i++) {
+            double w = weighted ? weights[i] : 1.0;
+            var[0] += w * (particles.x[i] - mean[0]) * (particles.x[i] - mean[0]);
+            var[1] += w * (particles.y[i] - mean[1]) * (particles.y[i] - mean[1]);
+        }
+        var[0] /= total;
+        var[1] /= total;
+
+        particle avg, variance;
+        computeMoments(particles, weighted ? weights.data() : nullptr, &avg, &variance);
+        EXPECT_NEAR(avg.x, mean[0], 1e-3);
+        EXPECT_NEAR(avg.y, mean[1], 1e-3);
+        EXPECT_NEAR(variance.x, var[0], 1e-3 * var[0]);
+        EXPECT_NEAR(variance.y, var[1], 1e-3 * var[1]);
+        EXPECT_NEAR(variance.z, 0.0, 1e-9);
+    }
+}
+
+TEST(FilterTest, EstimateStateBatch) {
+    Filter filter(1000, false);
+    particle anchorVars = {0.1, 0.1, 0.1, 0.1};
+    std::vector<particle> anchors = {{0.0, 10.0, 0.0, 0.0}, {10.0, 0.0, 0.0, 0.0}, {0.0, 0.0, 10.0, 0.0}, {10.0, 10.0, 10.0, 0.0}};
+    particle truePos = {0.0, 0.0, 0.0, 0.0};
+    std::vector<float> measurements;
+    for (const particle& anchor : anchors) {
+        measurements.push_back(dist(truePos, anchor));
+    }
+    std::vector<particle> vars(anchors.size(), anchorVars);
+
+    for (int round = 0; round < 4; round++) {
+        filter.estimateStateBatch(measurements, anchors, vars);
+    }
+    std::cout << "Estimated distance after 4 batched rounds: " << dist(filter.getEstimateAvg(), truePos) << std::endl;
+    EXPECT_NEAR(dist(filter.getEstimateAvg(), truePos), 0.0, 1.0);
+
+    vars.pop_back();
+    EXPECT_THROW(filter.estimateStateBatch(measurements, anchors, vars), std::invalid_argument);
+}
+
+TEST(FilterTest, PackPositions) {
+    Filter filter(10, false);
+    for (int i = 0; i < 10; i++) {
+        filter.set(i, {1.0f * i, 2.0f * i, 3.0f * i, 0.0f});
+    }
+    EXPECT_EQ(filter.getParticles().x.data()[4], 4.0f);
+
+    int count = filter.packPositions(3);
+    ASSERT_EQ(count, 4);
+    const float* positions = filter.getPackedPositions();
+    for (int k = 0; k < count; k++) {
+        EXPECT_EQ(positions[3 * k], 3.0f * k);
+        EXPECT_EQ(positions[3 * k + 1], 6.0f * k);
+        EXPECT_EQ(positions[3 * k + 2], 9.0f * k);
+    }
+    EXPECT_EQ(filter.packPositions(1), 10);
+    EXPECT_THROW(filter.packPositions(0), std::invalid_argument);
+}
+
+TEST(FilterTest, SteadyStateUpdatesDoNotAllocate) {
+    // the hook sees the filter's own buffers
+    long beforeConstruction = allocationCount;
+    Filter filter(10000, true);
+    EXPECT_GT(allocationCount - beforeConstruction, 0);
+    particle anchorVars = {0.1, 0.1, 0.1, 0.01};
+    std::vector<float> measurements;
+    for (const particle& anchor : cornerAnchors) {
+        measurements.push_back(dist(meshNodes[0], anchor));
+    }
+    std::vector<particle> vars(cornerAnchors.size(), anchorVars);
+    filter.estimateState(measurements[0], 0, cornerAnchors[0], anchorVars);
+
+    long before = allocationCount;
+    for (int round = 0; round < 3; round++) {
+        for (int j = 0; j < 4; j++) {
+            filter.estimateState(measurements[j], 0, cornerAnchors[j], anchorVars);
+        }
+        filter.estimateStateBatch(measurements, cornerAnchors, vars);
+    }
+    // a far off measurement forces the reinitialization path as well
+    filter.estimateState(100.0f, 0, cornerAnchors[0], anchorVars);
+    EXPECT_EQ(allocationCount - before, 0);
+}
+
+TEST(FilterTest, BasicFilterMatchesFilter) {
+    // same seed, same kernels and update: the compile-time core reproduces the runtime filter exactly
+    Filter filter(2000, false, 5);
+    BasicFilter<false> basic(2000, 5);
+    Filter delayFilter(2000, true, 5);
+    BasicFilter<true> delayBasic(2000, 5);
+    rangeCorners(filter, 3);
+    rangeCorners(delayFilter, 3);
+    for (int round = 0; round < 3; round++) {
+        for (const particle& anchor : cornerAnchors) {
+            basic.estimateState(dist(cornerNode, anchor), anchor, cornerVars);
+            delayBasic.estimateState(dist(cornerNode, anchor), anchor, cornerVars);
+        }
+    }
+    EXPECT_EQ(filter.getEstimateAvg().x, basic.getEstimateAvg().x);
+    EXPECT_EQ(filter.getEstimateAvg().z, basic.getEstimateAvg().z);
+    EXPECT_EQ(delayFilter.getEstimateAvg().x, delayBasic.getEstimateAvg().x);
+    EXPECT_EQ(delayFilter.getEstimateAvg().d, delayBasic.getEstimateAvg().d);
+    EXPECT_NEAR(dist(basic.getEstimateAvg(), cornerNode), 0.0, 1.0);
+
+    // without delay modelling no d is stored
+    EXPECT_EQ(basic.getParticles().d.size(), 0);
+    EXPECT_EQ(filter.getParticles().d.size(), 0);
+    EXPECT_EQ(delayBasic.getParticles().d.size(), 2000);
+    EXPECT_EQ(filter.get(0).d, 0.0f);
+
+    // a fixed-size anchor filter never touches the heap
+    long before = allocationCount;
+    {
+        BasicFilter<false, 1> anchor;
+        BasicFilter<true, 64> small(64);
+        for (int round = 0; round < 3; round++) {
+            anchor.estimateState(5.0f, cornerAnchors[0], cornerVars);
+            small.estimateState(dist(cornerNode, cornerAnchors[round]), cornerAnchors[round], cornerVars);
+        }
+        EXPECT_EQ(anchor.getN(), 1);
+        EXPECT_TRUE(std::isfinite(small.getEstimateAvg().x));
+    }
+    EXPECT_EQ(allocationCount - before, 0);
+    EXPECT_THROW((BasicFilter<false, 1>(2)), std::invalid_argument);
+}
+
+TEST(FilterTest, AdaptiveParticleCount) {
+    Filter filter(1000, false);
+    filter.setAdaptive(true, 300, 20000);
+
+    filter.estimateState(dist(cornerNode, cornerAnchors[0]), 0, cornerAnchors[0], cornerVars);
+    EXPECT_EQ(filter.getN(), 20000);
+    for (int round = 0; round < 5; round++) {
+        for (const particle& anchor : cornerAnchors) {
+            filter.estimateState(dist(cornerNode, anchor), 0, anchor, cornerVars);
+            EXPECT_GE(filter.getN(), 300);
+            EXPECT_LE(filter.getN(), 20000);
+        }
+    }
+    std::cout << "Adaptive N after convergence: " << filter.getN()
+              << ", distance: " << dist(filter.getEstimateAvg(), cornerNode) << std::endl;
+    EXPECT_LT(filter.getN(), 5000);
+    EXPECT_NEAR(dist(filter.getEstimateAvg(), cornerNode), 0.0, 1.0);
+
+    filter.setN(500);
+    EXPECT_FALSE(filter.isAdaptive());
+    EXPECT_EQ(filter.getN(), 500);
+    EXPECT_THROW(filter.setAdaptive(true, 100, 50), std::invalid_argument);
+}
+
+TEST(FilterTest, EssGatedResampling) {
+    particle vagueVars{1000, 1000, 1000, 0.1};
+    for (float threshold : {0.5f, 2.0f}) {
+        Filter filter(2000, false);
+        filter.setResampleThreshold(threshold);
+        EXPECT_EQ(filter.getResampleThreshold(), threshold);
+        rangeCorners(filter, 3);
+        EXPECT_NEAR(dist(filter.getEstimateAvg(), cornerNode), 0.0, 1.0);
+
+        // a nearly flat likelihood keeps the ESS high: the cloud is only reweighted
+        particle before = filter.get(0);
+        filter.estimateState(dist(cornerNode, cornerAnchors[0]), 0, cornerAnchors[0], vagueVars);
+        particle after = filter.get(0);
+        if (threshold <= 1.0f) {
+            EXPECT_EQ(before.x, after.x);
+            EXPECT_EQ(before.y, after.y);
+            EXPECT_EQ(before.z, after.z);
+        } else {
+            EXPECT_NE(before.x, after.x);
+        }
+        EXPECT_NEAR(dist(filter.getEstimateAvg(), cornerNode), 0.0, 1.0);
+    }
+}
+
+TEST(FilterTest, Stats) {
+    Filter filter(2000, false);
+    filter.setResampleThreshold(2.0f);
+    rangeCorners(filter, 3);
+    FilterStats stats = filter.getStats();
+#if FILTER_STATS
+    EXPECT_GT(stats.lastESS, 0.0f);
+    EXPECT_LE(stats.lastESS, 2000.0f);
+    EXPECT_EQ(stats.updates, 11);
+    EXPECT_EQ(stats.resamples + stats.reinitializations, 11);
+    EXPECT_GT(stats.initNs, 0);
+    EXPECT_GT(stats.weightingNs, 0);
+    if (stats.resamples > 0) {
+        EXPECT_GT(stats.resampleNs, 0);
+        EXPECT_GT(stats.duplicates, 0);
+        EXPECT_GE(stats.longestRun, 2);
+    }
+#endif
+
+    // a far off range collapses the weights and is counted as a reinitialization
+    double reinitializations = stats.reinitializations;
+    filter.estimateState(1000.0f, 0, cornerAnchors[0], cornerVars);
+#if FILTER_STATS
+    EXPECT_EQ(filter.getStats().reinitializations, reinitializations + 1);
+#endif
+
+    filter.resetStats();
+    stats = filter.getStats();
+    EXPECT_EQ(stats.updates, 0);
+    EXPECT_EQ(stats.initNs, 0);
+    EXPECT_EQ(stats.duplicates, 0);
+}
+
+TEST(FilterTest, ParallelResampleMatchesSerial) {
+    // a peaked weight profile over a line of particles, so many outputs duplicate the same source
+    const int n = 100000;
+    ParticleSet particles;
+    particles.resize(n);
+    AlignedArray weights(n);
+    for (int i = 0; i < n; i++) {
+        particles.set(i, {i * 0.001f, 5.0f - i * 0.0005f, 1.0f, 0.1f});
+        float u = (i - 40000) / 3000.0f;
+        weights[i] = std::exp(-0.5f * u * u);
+    }
+    const particle sigma = {0.01f, 0.01f, 0.01f, 0.001f};
+
+    AlignedArray normalized(n);
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) sum += weights[i];
+    for (int i = 0; i < n; i++) normalized[i] = weights[i] / sum;
+    AlignedArray noise(4 * n);
+    Rng rng(3);
+    rng.fillGaussian(noise.data(), 4 * n, 0.0f, 1.0f);
+    ParticleSet serial;
+    particle serialAvg, serialVar;
+    int serialLongest = 0;
+    int serialDuplicates = resampleSystematic(particles, normalized.data(), n, 0.3f / n, noise.data(), sigma, true,
+                                              serial, &serialAvg, &serialVar, &serialLongest);
+
+    AlignedArray cumulative(n);
+    ParticleSet parallel[2];
+    particle avg[2], var[2];
+    int duplicates[2], longest[2];
+    for (int t = 0; t < 2; t++) {
+        ThreadPool pool(t == 0 ? 1 : 4);
+        duplicates[t] = resampleSystematicParallel(particles, weights.data(), cumulative.data(), n, 0.3f / n, 11,
+                                                   noise.data(), sigma, true, parallel[t], &avg[t], &var[t], pool,
+                                                   &longest[t]);
+    }
+    // the thread count does not change the result
+    for (int i = 0; i < n; i += 997) {
+        EXPECT_EQ(parallel[0].x[i], parallel[1].x[i]);
+        EXPECT_EQ(parallel[0].d[i], parallel[1].d[i]);
+    }
+    EXPECT_EQ(duplicates[0], duplicates[1]);
+
+    // same output distribution as the serial resampler
+    EXPECT_EQ(parallel[1].size(), n);
+    EXPECT_NEAR(avg[1].x, serialAvg.x, 0.01);
+    EXPECT_NEAR(avg[1].y, serialAvg.y, 0.01);
+    EXPECT_NEAR(var[1].x, serialVar.x, 0.02 * serialVar.x);
+    EXPECT_NEAR(var[1].y, serialVar.y, 0.02 * serialVar.y);
+    EXPECT_NEAR(duplicates[1], serialDuplicates, 0.01 * serialDuplicates);
+    EXPECT_EQ(longest[1], serialLongest);
+
+    // and a filter resampling on the pool still converges
+    Filter filter(20000, false);
+    filter.setResampleThreads(4);
+    EXPECT_EQ(filter.getResampleThreads(), 4);
+    rangeCorners(filter, 3);
+    EXPECT_NEAR(dist(filter.getEstimateAvg(), cornerNode), 0.0, 1.0);
+}
+
+TEST(FilterTest, SeededRunsAreReproducible) {
+    particle anchor = {2.0, 0.5, -8.0, 0.0};
+    particle anchorVar = {0.1, 0.1, 0.1, 0.1};
+    Filter a(500, true, 7);
+    Filter b(500, true, 7);
+    Filter c(500, true, 8);
+    for (int round = 0; round < 3; round++) {
+        a.estimateState(10.0, 0, anchor, anchorVar);
+        b.estimateState(10.0, 0, anchor, anchorVar);
+        c.estimateState(10.0, 0, anchor, anchorVar);
+    }
+    for (int i = 0; i < 500; i++) {
+        EXPECT_EQ(a.get(i).x, b.get(i).x);
+        EXPECT_EQ(a.get(i).d, b.get(i).d);
+    }
+    EXPECT_NE(a.getEstimateAvg().x, c.getEstimateAvg().x);
+
+    // reseeding restarts the stream
+    a.seed(3);
+    a.setN(500);
+    b.seed(3);
+    b.setN(500);
+    a.estimateState(10.0, 0, anchor, anchorVar);
+    b.estimateState(10.0, 0, anchor, anchorVar);
+    EXPECT_EQ(a.getEstimateAvg().x, b.getEstimateAvg().x);
+}
+
+TEST(FilterTest, TraceReplayReproducesRun) {
+    std::string path = testing::TempDir() + "geometry.trace";
+    std::vector<Filter> live;
+    {
+        auto recorder = std::make_shared<TraceWriter>(path);
+        for (int i = 0; i < 3; i++) {
+            live.emplace_back(2000, i == 2, Rng::defaultSeed + i);
+            live[i].setTraceRecorder(recorder, i);
+        }
+        for (int i = 0; i < 3; i++) {
+            rangeCorners(live[i], 1, meshNodes[i]);
+        }
+        // one batched call, then mesh updates against the live estimates
+        live[0].estimateStateBatch({dist(meshNodes[0], cornerAnchors[0]), dist(meshNodes[0], cornerAnchors[1])},
+                                   {cornerAnchors[0], cornerAnchors[1]}, {cornerVars, cornerVars});
+        for (int round = 0; round < 3; round++) {
+            for (int j = 0; j < 3; j++) {
+                int k = (j + 1) % 3;
+                live[j].estimateState(dist(meshNodes[j], meshNodes[k]), 0, live[k].getEstimateAvg(),
+                                      live[k].getEstimateVar());
+            }
+        }
+        for (Filter& filter : live) {
+            filter.setTraceRecorder(nullptr);
+        }
+    }
+
+    TraceReader trace(path);
+    EXPECT_EQ(trace.size(), 3u * 4 + 2 + 3 * 3);
+    std::vector<Filter> replayed;
+    for (int i = 0; i < 3; i++) {
+        replayed.emplace_back(2000, i == 2, Rng::defaultSeed + i);
+    }
+    size_t i = 0;
+    while (i < trace.size()) {
+        i = replayCall(trace, i, replayed[trace[i].node]);
+    }
+    for (int n = 0; n < 3; n++) {
+        EXPECT_EQ(replayed[n].getEstimateAvg().x, live[n].getEstimateAvg().x) << "node " << n;
+        EXPECT_EQ(replayed[n].getEstimateAvg().y, live[n].getEstimateAvg().y) << "node " << n;
+        EXPECT_EQ(replayed[n].getEstimateAvg().z, live[n].getEstimateAvg().z) << "node " << n;
+        EXPECT_EQ(replayed[n].getEstimateVar().x, live[n].getEstimateVar().x) << "node " << n;
+    }
+    // continuation records cannot start a call
+    EXPECT_THROW(replayCall(trace, 3u * 4 + 1, replayed[0]), std::runtime_error);
+
+    std::ofstream(testing::TempDir() + "not_a.trace") << "id,x,y,z\n0,1,2,3\n";
+    EXPECT_THROW(TraceReader(testing::TempDir() + "not_a.trace"), std::runtime_error);
+    std::remove((testing::TempDir() + "not_a.trace").c_str());
+    std::remove(path.c_str());
+}
+
+TEST(FilterTest, TelemetryDrain) {
+    // a full ring drops and counts instead of blocking
+    TelemetryRing ring(3);
+    EXPECT_EQ(ring.capacity(), 4u);
+    TelemetryRecord record{};
+    for (uint32_t i = 0; i < 5; i++) {
+        record.node = i;
+        EXPECT_EQ(ring.push(record), i < 4);
+    }
+    EXPECT_EQ(ring.getDropped(), 1u);
+    EXPECT_TRUE(ring.pop(&record));
+    EXPECT_EQ(record.node, 0u);
+
+    std::string path = testing::TempDir() + "bank.telemetry";
+    FilterBank bank(3, 2000, false, 1, 2);
+    {
+        TelemetryDrain drain(path);
+        bank.setTelemetry(drain);
+        bank.runRound(cornerJobs(3));
+        drain.stop();
+        EXPECT_EQ(drain.getWritten(), 12u);
+        EXPECT_EQ(drain.getDropped(), 0u);
+        for (int i = 0; i < 3; i++) {
+            bank.node(i).setTelemetry(nullptr);
+        }
+    }
+
+    // records of a node are in update order, its last one is the final estimate
+    std::ifstream in(path, std::ios::binary);
+    std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    ASSERT_EQ(bytes.size(), size_t(telemetryHeaderSize + 12 * telemetryRecordSize));
+    EXPECT_EQ(getU32(bytes.data() + 8), uint32_t(telemetryRecordSize));
+    std::vector<int> seen(3, 0);
+    for (int r = 0; r < 12; r++) {
+        const unsigned char* p = bytes.data() + telemetryHeaderSize + r * telemetryRecordSize;
+        uint32_t node = getU32(p);
+        ASSERT_LT(node, 3u);
+        EXPECT_EQ(getU32(p + 4), 1u);
+        if (++seen[node] == 4) {
+            EXPECT_EQ(getF32(p + 16), bank.getEstimateAvg(node).x);
+            EXPECT_EQ(getF32(p + 36), bank.getEstimateVar(node).y);
+        }
+    }
+}
+
+TEST(FilterTest, ArenaMovesAndClones) {
+    EXPECT_EQ(ParticleArena::blockSize(1), 64u);
+    EXPECT_EQ(ParticleArena::blockSize(40000), 40960u);
+
+    auto arena = std::make_shared<ParticleArena>();
+    {
+        // arena memory changes nothing in the results
+        Filter heap(3000, true, 9);
+        Filter pooled(3000, true, 9, arena);
+        rangeCorners(heap, 1);
+        rangeCorners(pooled, 1);
+        EXPECT_EQ(pooled.getEstimateAvg().x, heap.getEstimateAvg().x);
+        EXPECT_EQ(pooled.getEstimateVar().d, heap.getEstimateVar().d);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(pooled.getParticles().x.data()) % 64, 0u);
+
+        // a move hands the buffers over, a clone continues like the original on its own
+        const float* storage = pooled.getParticles().x.data();
+        Filter moved(std::move(pooled));
+        EXPECT_EQ(moved.getParticles().x.data(), storage);
+        Filter copy = moved.clone();
+        EXPECT_NE(copy.getParticles().x.data(), storage);
+        moved.estimateState(dist(cornerNode, cornerAnchors[0]), 0, cornerAnchors[0], cornerVars);
+        copy.estimateState(dist(cornerNode, cornerAnchors[0]), 0, cornerAnchors[0], cornerVars);
+        EXPECT_EQ(copy.getEstimateAvg().y, moved.getEstimateAvg().y);
+        copy.set(0, {1, 2, 3, 0});
+        EXPECT_NE(moved.get(0).x, 1.0f);
+
+        // shrinking keeps the blocks, growing back to the old size does not allocate
+        size_t used = arena->usedBytes();
+        moved.setN(1000);
+        moved.setN(3000);
+        EXPECT_EQ(arena->usedBytes(), used);
+    }
+    // freed blocks are reused by the next filters instead of taking new chunks
+    EXPECT_EQ(arena->usedBytes(), 0u);
+    size_t reserved = arena->reservedBytes();
+    {
+        Filter a(3000, true, 1, arena);
+        Filter b(3000, true, 2, arena);
+        EXPECT_EQ(arena->reservedBytes(), reserved);
+    }
+
+    // Fixed16 filters resample through the per-thread buffers, their own blocks stay in the arena whatever
+    // the number of resamples
+    auto compactArena = std::make_shared<ParticleArena>();
+    for (int updates = 2; updates <= 3; updates++) {
+        {
+            Filter a(3000, true, 3, compactArena);
+            a.setStorage(ParticleStorage::Fixed16);
+            a.setResampleThreshold(1.0f);
+            for (int j = 0; j < updates; j++) {
+                a.estimateState(dist(cornerNode, cornerAnchors[j]), 0, cornerAnchors[j], cornerVars);
+            }
+            EXPECT_GT(compactArena->usedBytes(), 0u);
+        }
+        EXPECT_EQ(compactArena->usedBytes(), 0u);
+        EXPECT_EQ(compactArena.use_count(), 1);
+    }
+}
+
+TEST(FilterTest, SnapshotRoundTrip) {
+    Filter a(3000, true, 5);
+    a.setResampleThreshold(0.1f);
+    for (int j = 0; j < 3; j++) {
+        a.estimateState(dist(meshNodes[0], cornerAnchors[j]), 0, cornerAnchors[j], cornerVars);
+    }
+
+    // restore into a filter with other settings, then both must continue identically
+    std::vector<uint8_t> bytes = a.serialize();
+    Filter b(10, false, 99);
+    b.deserialize(bytes);
+    EXPECT_EQ(b.getN(), 3000);
+    EXPECT_EQ(b.getResampleThreshold(), 0.1f);
+    EXPECT_EQ(b.getParticles().d.size(), 3000);
+    for (int i = 0; i < 3000; i += 7) {
+        EXPECT_EQ(b.get(i).x, a.get(i).x);
+        EXPECT_EQ(b.get(i).d, a.get(i).d);
+    }
+    a.estimateState(dist(meshNodes[0], cornerAnchors[3]), 0, cornerAnchors[3], cornerVars);
+    b.estimateState(dist(meshNodes[0], cornerAnchors[3]), 0, cornerAnchors[3], cornerVars);
+    EXPECT_EQ(b.getEstimateAvg().x, a.getEstimateAvg().x);
+    EXPECT_EQ(b.getEstimateAvg().z, a.getEstimateAvg().z);
+    EXPECT_EQ(b.getEstimateVar().y, a.getEstimateVar().y);
+
+    // quantized positions land within half a step of the originals
+    std::vector<uint8_t> small = a.serialize(true);
+    EXPECT_LT(small.size(), bytes.size() * 2 / 3);
+    Filter c(1, false);
+    c.deserialize(small);
+    particle avg = a.getEstimateAvg();
+    float largest = 0.0f;
+    for (int i = 0; i < 3000; i++) {
+        largest = std::max(largest, std::fabs(a.get(i).x - avg.x));
+    }
+    for (int i = 0; i < 3000; i++) {
+        EXPECT_NEAR(c.get(i).x, a.get(i).x, 0.5f * largest / 32767 + 1e-5f) << "particle " << i;
+    }
+    Filter exact(1, false);
+    exact.deserialize(a.serialize());
+    c.estimateState(dist(meshNodes[0], cornerAnchors[0]), 0, cornerAnchors[0], cornerVars);
+    exact.estimateState(dist(meshNodes[0], cornerAnchors[0]), 0, cornerAnchors[0], cornerVars);
+    EXPECT_NEAR(dist(c.getEstimateAvg(), exact.getEstimateAvg()), 0.0, 0.05);
+
+    // adaptive settings survive, and a damaged snapshot leaves the filter untouched
+    Filter adaptive(100, false);
+    adaptive.setAdaptive(true, 50, 2000);
+    adaptive.estimateState(5.0f, 0, cornerAnchors[0], cornerVars);
+    b.deserialize(adaptive.serialize());
+    EXPECT_TRUE(b.isAdaptive());
+    EXPECT_EQ(b.getN(), 2000);
+    std::vector<uint8_t> truncated(bytes.begin(), bytes.end() - 5);
+    EXPECT_THROW(b.deserialize(truncated), std::invalid_argument);
+    bytes[4] = 9;
+    EXPECT_THROW(b.deserialize(bytes), std::invalid_argument);
+    EXPECT_EQ(b.getN(), 2000);
+}
+
+TEST(FilterTest, RngBlockMoments) {
+    Rng rng(11);
+    const int n = 100001;
+    std::vector<float> samples(n);
+    rng.fillGaussian(samples.data(), n, 2.0f, 0.5f);
+    double mean = 0.0, var = 0.0;
+    for (float s : samples) mean += s;
+    mean /= n;
+    for (float s : samples) var += (s - mean) * (s - mean);
+    var /= n;
+    EXPECT_NEAR(mean, 2.0, 0.01);
+    EXPECT_NEAR(var, 0.25, 0.01);
+
+    rng.fillUniform(samples.data(), n, -1.0f, 3.0f);
+    mean = 0.0;
+    for (float s : samples) {
+        EXPECT_GE(s, -1.0f);
+        EXPECT_LT(s, 3.0f);
+        mean += s;
+    }
+    EXPECT_NEAR(mean / n, 1.0, 0.02);
+
+    rng.fillExponential(samples.data(), n, 10.0f);
+    mean = 0.0;
+    for (float s : samples) mean += s;
+    EXPECT_NEAR(mean / n, 0.1, 0.005);
+}
+
+TEST(FilterTest, RandomizedConvergence){
+    // nodes anywhere in the 50 m box converge on the four test anchors, from 50 random scenarios
+    ThreadPool pool(0);
+    ScenarioConfig config;
+    config.N = 1000;
+    config.rounds = 20;
+    config.nodesPerLayer = 1;
+    std::vector<ScenarioResult> results = runScenarios(config, 50, 1, pool);
+    ASSERT_EQ(results.size(), 50u);
+    for (const ScenarioResult& result : results) {
+        ASSERT_EQ(result.finalError.size(), 1u);
+        EXPECT_LT(result.finalError[0], 1.5);
+        EXPECT_EQ(result.updates, 80);
+    }
+    // the same seed gives the same scenario
+    ScenarioResult again = runScenario(config, 1);
+    EXPECT_EQ(again.finalError[0], results[0].finalError[0]);
+
+    // a relay layer ranging the estimates of the first still gets below the accuracy, at a cost
+    config.depth = 1;
+    config.nodesPerLayer = 4;
+    config.rounds = 10;
+    SweepSummary summary = summarize(runScenarios(config, 8, 1, pool));
+    EXPECT_EQ(summary.nodes, 64);
+    EXPECT_GT(summary.converged, summary.nodes / 2);
+    EXPECT_GT(summary.updatesToAccuracy, 0);
+    EXPECT_GT(summary.timeToAccuracyUs, 0);
+    EXPECT_LE(summary.p50LatencyUs, summary.p99LatencyUs);
+    EXPECT_GE(summary.reinitRate, 0);
+}
 
 TEST(FilterTest, ConvergenceAnchors){
     // in this test we study the convergence of the node according to N Particules
@@ -148,6 +906,95 @@ TEST(FilterTest, ConvergenceAnchors){
     }
 }
 
+TEST(FilterTest, MultilaterationProposal) {
+    // exact ranges are fixed exactly, coplanar anchors are rejected
+    std::vector<float> ranges;
+    for (const particle& anchor : cornerAnchors) {
+        ranges.push_back(dist(cornerNode, anchor));
+    }
+    std::vector<particle> vars(4, cornerVars);
+    RangeFix fix;
+    ASSERT_TRUE(multilaterate(ranges.data(), cornerAnchors.data(), vars.data(), 4, false, &fix));
+    EXPECT_NEAR(dist(fix.mean, cornerNode), 0.0, 1e-3);
+    EXPECT_EQ(fix.dof, 1);
+    EXPECT_GT(fix.covariance[0][0], 0.0);
+    std::vector<particle> flat = {{0, 0, 0, 0}, {10, 0, 0, 0}, {0, 10, 0, 0}, {10, 10, 0, 0}};
+    EXPECT_FALSE(multilaterate(ranges.data(), flat.data(), vars.data(), 4, false, &fix));
+
+    // ConvergenceAnchors accuracy after one round with 500 particles instead of 5 rounds with 10000
+    for (bool delay : {false, true}) {
+        Filter sphere(500, delay, 4);
+        Filter proposal(500, delay, 4);
+        proposal.setInitMode(InitMode::Multilateration);
+        // with the delay one more range than anchors is needed
+        for (int update = 0; update < (delay ? 5 : 4); update++) {
+            const particle& anchor = cornerAnchors[update % 4];
+            sphere.estimateState(dist(cornerNode, anchor), 0, anchor, cornerVars);
+            proposal.estimateState(dist(cornerNode, anchor), 0, anchor, cornerVars);
+        }
+        float sphereError = dist(sphere.getEstimateAvg(), cornerNode);
+        float proposalError = dist(proposal.getEstimateAvg(), cornerNode);
+        // with the same particles and updates the sphere init stays outside the bound the proposal meets
+        EXPECT_NEAR(proposalError, 0.0, 0.3);
+        EXPECT_GT(sphereError, 0.3);
+        EXPECT_LT(proposalError, sphereError);
+        EXPECT_EQ(proposal.getInitMode(), InitMode::Multilateration);
+#if FILTER_STATS
+        EXPECT_EQ(proposal.getStats().proposals, 1);
+#endif
+    }
+    Filter filter(100, true);
+    EXPECT_THROW(filter.setInitMode(InitMode::Multilateration, 4), std::invalid_argument);
+}
+
+TEST(FilterTest, CollapseRecovery) {
+    // a converged node gets a 5 m NLOS range now and then, each one collapses the weights
+    for (ParticleStorage storage : {ParticleStorage::Float, ParticleStorage::Fixed16}) {
+        Filter reinit(2000, false, 3);
+        Filter recover(2000, false, 3);
+        reinit.setStorage(storage);
+        recover.setStorage(storage);
+        recover.setCollapseRecovery(true);
+        rangeCorners(reinit, 3);
+        rangeCorners(recover, 3);
+        float reinitError = 0.0f, recoverError = 0.0f;
+        float reinitJump = 0.0f, recoverJump = 0.0f;
+        for (int outlier = 0; outlier < 3; outlier++) {
+            const particle reinitBefore = reinit.getEstimateAvg(), recoverBefore = recover.getEstimateAvg();
+            reinit.estimateState(dist(cornerNode, cornerAnchors[outlier]) + 5, 0, cornerAnchors[outlier], cornerVars);
+            recover.estimateState(dist(cornerNode, cornerAnchors[outlier]) + 5, 0, cornerAnchors[outlier], cornerVars);
+            reinitJump = std::max(reinitJump, dist(reinit.getEstimateAvg(), reinitBefore));
+            recoverJump = std::max(recoverJump, dist(recover.getEstimateAvg(), recoverBefore));
+            for (int j = 1; j <= 2; j++) {
+                const particle& anchor = cornerAnchors[(outlier + j) % 4];
+                reinit.estimateState(dist(cornerNode, anchor), 0, anchor, cornerVars);
+                recover.estimateState(dist(cornerNode, anchor), 0, anchor, cornerVars);
+            }
+            reinitError += dist(reinit.getEstimateAvg(), cornerNode) / 3;
+            recoverError += dist(recover.getEstimateAvg(), cornerNode) / 3;
+        }
+        // recovery keeps the cloud: on a collapse the estimate moves by less than the outlier, where a
+        // reinitialization restarts it on a sphere around the anchor
+        EXPECT_LT(recoverJump, 5.0f);
+        EXPECT_LT(recoverJump, reinitJump);
+        EXPECT_LT(recoverError, 1.5f);
+        EXPECT_LT(recoverError, reinitError);
+#if FILTER_STATS
+        FilterStats stats = recover.getStats();
+        EXPECT_GT(reinit.getStats().reinitializations, 0);
+        EXPECT_GT(stats.collapses, 0);
+        EXPECT_EQ(stats.reinitializations, 0);
+        EXPECT_EQ(stats.reinjections, stats.collapses);
+        EXPECT_LE(stats.reinjectedParticles, stats.collapses * 2000 / 2);
+#endif
+    }
+
+    Filter filter(100, true);
+    EXPECT_THROW(filter.setCollapseRecovery(true, 0.5f, 0.1f), std::invalid_argument);
+    EXPECT_THROW(filter.setCollapseRecovery(true, 0.1f, 0.5f, 0.0f), std::invalid_argument);
+    EXPECT_FALSE(filter.getCollapseRecovery());
+}
+
 TEST(FilterTest, EstimateGeometry) {
     // in this test we perform one round of updates from teh anchors then only from the mesh 
     std::ofstream memLog("Geometry_convergence.csv");
@@ -165,7 +1012,12 @@ TEST(FilterTest, EstimateGeometry) {
     particle anchor2{ 12, 14, -8, 0.0};
     particle anchor3{ 12, 0.5, 2, 0.0};
     particle anchorVars{ 0.1, 0.1, 0.1, 0.1};
-    std::vector<Filter> nodes = {node0, node1, node2, node3};
+    // filters are move-only, the vector takes them over instead of copying four particle sets
+    std::vector<Filter> nodes;
+    nodes.push_back(std::move(node0));
+    nodes.push_back(std::move(node1));
+    nodes.push_back(std::move(node2));
+    nodes.push_back(std::move(node3));
     std::vector<particle> nodePositions = {node0Position, node1Position, node2Position, node3Position};
     std::vector<particle> anchors = {anchor0, anchor1, anchor2, anchor3};
     // perform one round of updates from the anchors
@@ -200,6 +1052,232 @@ TEST(FilterTest, EstimateGeometry) {
     
 }
 
+// Same scenario as EstimateGeometry, run through the bank
+static std::vector<particle> runBankGeometry(int threads) {
+    FilterBank bank(4, 10000, false, 1, threads);
+    bank.runRound(cornerJobs(4));
+
+    std::vector<BankJob> meshRound;
+    for (int j = 0; j < 4; j++) {
+        for (int k = 0; k < 4; k++) {
+            if (j != k) {
+                meshRound.push_back({j, dist(meshNodes[j], meshNodes[k]), k});
+            }
+        }
+    }
+    for (int round = 0; round < 10; round++) {
+        bank.runRound(meshRound);
+    }
+
+    std::vector<particle> estimates;
+    for (int i = 0; i < 4; i++) {
+        estimates.push_back(bank.getEstimateAvg(i));
+        EXPECT_NEAR(dist(estimates[i], meshNodes[i]), 0.0, 1.0) << "node " << i;
+    }
+    return estimates;
+}
+
+TEST(FilterBankTest, ParallelRoundsMatchSerial) {
+    std::vector<particle> serial = runBankGeometry(1);
+    std::vector<particle> parallel = runBankGeometry(4);
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(serial[i].x, parallel[i].x);
+        EXPECT_EQ(serial[i].y, parallel[i].y);
+        EXPECT_EQ(serial[i].z, parallel[i].z);
+    }
+    // -1 is the only index that means an anchor
+    FilterBank bank(2, 100, false);
+    EXPECT_THROW(bank.runRound({{0, 1.0f, -2}}), std::out_of_range);
+    EXPECT_THROW(bank.runRound({{0, 1.0f, 2}}), std::out_of_range);
+}
+
+// EstimateGeometry with the given particle storage, returns the final distance of each node to the truth
+static std::vector<float> runStorageGeometry(ParticleStorage storage) {
+    std::vector<Filter> nodes;
+    for (int i = 0; i < 4; i++) {
+        nodes.emplace_back(10000, false, 1 + i);
+        nodes[i].setStorage(storage);
+        rangeCorners(nodes[i], 1, meshNodes[i]);
+    }
+    for (int round = 0; round < 10; round++) {
+        for (int j = 0; j < 4; j++) {
+            for (int k = 0; k < 4; k++) {
+                if (j != k) {
+                    nodes[j].estimateState(dist(meshNodes[j], meshNodes[k]), 0, nodes[k].getEstimateAvg(),
+                                           nodes[k].getEstimateVar());
+                }
+            }
+        }
+    }
+    std::vector<float> distances;
+    for (int i = 0; i < 4; i++) {
+        distances.push_back(dist(nodes[i].getEstimateAvg(), meshNodes[i]));
+        if (storage == ParticleStorage::Fixed16) {
+            EXPECT_EQ(nodes[i].getParticles().size(), 0) << "node " << i;
+        }
+    }
+    return distances;
+}
+
+TEST(FilterTest, CompactStorageAccuracy) {
+    std::vector<float> full = runStorageGeometry(ParticleStorage::Float);
+    std::vector<float> compact = runStorageGeometry(ParticleStorage::Fixed16);
+    for (int i = 0; i < 4; i++) {
+        std::cout << "node " << i << ": float " << full[i] << " m, fixed16 " << compact[i] << " m" << std::endl;
+        EXPECT_NEAR(compact[i], 0.0, 1.0) << "node " << i;
+        EXPECT_NEAR(compact[i], full[i], 0.5) << "node " << i;
+    }
+
+    // switching storage keeps the cloud to within a quantization step
+    Filter filter(1000, true, 3);
+    filter.estimateState(5.0f, 0, {0, 0, 0, 0}, {0.1, 0.1, 0.1, 0.1});
+    particle before = filter.get(17);
+    filter.setStorage(ParticleStorage::Fixed16);
+    particle after = filter.get(17);
+    EXPECT_NEAR(after.x, before.x, 1e-3);
+    EXPECT_NEAR(after.d, before.d, 1e-3);
+    filter.estimateState(5.0f, 0, {0, 0, 0, 0}, {0.1, 0.1, 0.1, 0.1});
+    Filter restored(1000, true);
+    restored.deserialize(filter.serialize());
+    EXPECT_EQ(restored.get(17).y, filter.get(17).y);
+    filter.setStorage(ParticleStorage::Float);
+    EXPECT_EQ(filter.getParticles().size(), filter.getN());
+}
+
+TEST(FilterBankTest, ThreadPoolRunsEveryTask) {
+    ThreadPool pool(3);
+    std::vector<int> hits(1000, 0);
+    pool.parallelFor(hits.size(), [&](int i) {
+        // nested loops are helped along by the waiting worker
+        pool.parallelFor(2, [&](int k) { if (k == 0) hits[i]++; });
+    });
+    for (int h : hits) {
+        EXPECT_EQ(h, 1);
+    }
+    EXPECT_THROW(pool.parallelFor(10, [](int i) { if (i == 7) throw std::runtime_error("task failed"); }),
+                 std::runtime_error);
+}
+
+TEST(MeshSchedulerTest, FewerUpdatesThanAllPairs) {
+    // the runBankGeometry mesh, whose anchor round and 10 all-pairs rounds take 136 updates
+    FilterBank bank(4, 10000, false, 1, 1);
+    MeshScheduler scheduler(bank);
+    for (const BankJob& job : cornerJobs(4)) {
+        scheduler.addLink(job);
+    }
+    int meshLink = -1;
+    for (int j = 0; j < 4; j++) {
+        for (int k = 0; k < 4; k++) {
+            if (j != k) {
+                meshLink = scheduler.addLink({j, dist(meshNodes[j], meshNodes[k]), k});
+            }
+        }
+    }
+    // neighbours without an estimate are not candidates
+    EXPECT_EQ(scheduler.expectedGain(meshLink), 0.0f);
+    EXPECT_GT(scheduler.expectedGain(0), 0.0f);
+
+    // one update per node per tick
+    for (int tick = 0; tick < 10; tick++) {
+        EXPECT_EQ(scheduler.tick(4), 4);
+    }
+    EXPECT_EQ(scheduler.getUpdates(), 40u);
+    for (int i = 0; i < 4; i++) {
+        EXPECT_NEAR(dist(bank.getEstimateAvg(i), meshNodes[i]), 0.0, 1.0) << "node " << i;
+    }
+
+    // a spent budget stops after the first wave, one update on a single thread
+    EXPECT_EQ(scheduler.tick(4, 1e-9), 1);
+    EXPECT_THROW(scheduler.addLink({4, 1.0f, 0}), std::out_of_range);
+    EXPECT_THROW(scheduler.addLink({0, 1.0f, 0}), std::out_of_range);
+    EXPECT_THROW(scheduler.addLink({0, 1.0f, -2}), std::out_of_range);
+}
+
+TEST(AsyncFilterTest, UpdatesCompleteInOrder) {
+    AsyncFilter async(5000, false, 5);
+    Filter reference(5000, false, 5);
+    std::vector<UpdateHandle> handles;
+    for (int round = 0; round < 3; round++) {
+        for (const particle& anchor : cornerAnchors) {
+            handles.push_back(async.estimateStateAsync(dist(meshNodes[0], anchor), 0, anchor, cornerVars));
+        }
+    }
+    rangeCorners(reference, 3, meshNodes[0]);
+    // the getters never wait for the worker
+    EXPECT_LE(async.getCompletedUpdates(), handles.size());
+
+    handles.back().wait();
+    for (size_t i = 0; i < handles.size(); i++) {
+        EXPECT_EQ(handles[i].sequence(), i + 1);
+        EXPECT_EQ(handles[i].status(), UpdateStatus::Done);
+    }
+    EXPECT_EQ(async.getCompletedUpdates(), handles.size());
+    EXPECT_EQ(async.getPendingUpdates(), 0);
+    EXPECT_EQ(async.getEstimateAvg().x, reference.getEstimateAvg().x);
+    EXPECT_EQ(async.getEstimateAvg().z, reference.getEstimateAvg().z);
+    EXPECT_EQ(async.getEstimateVar().y, reference.getEstimateVar().y);
+    EXPECT_EQ(async.getN(), reference.getN());
+    EXPECT_EQ(async.getStats().resamples, reference.getStats().resamples);
+    EXPECT_THROW(async.estimateStateBatchAsync({1.0f, 2.0f}, {cornerAnchors[0]}, {cornerVars}),
+                 std::invalid_argument);
+}
+
+TEST(AsyncFilterTest, QueuedUpdatesCanBeCancelled) {
+    AsyncFilter async(2000, false, 9);
+    Filter reference(2000, false, 9);
+    std::vector<UpdateHandle> handles;
+    // holding the filter keeps the worker from starting anything
+    async.withFilter([&](Filter&) {
+        for (int i = 0; i < 8; i++) {
+            const particle& anchor = cornerAnchors[i % 4];
+            handles.push_back(async.estimateStateAsync(dist(meshNodes[1], anchor), 0, anchor, cornerVars));
+        }
+        EXPECT_TRUE(handles[4].cancel());
+        EXPECT_FALSE(handles[4].cancel());
+        EXPECT_EQ(async.getPendingUpdates(), 7);
+    });
+    handles.back().wait();
+    for (int i = 0; i < 8; i++) {
+        EXPECT_EQ(handles[i].status(), i == 4 ? UpdateStatus::Cancelled : UpdateStatus::Done);
+        if (i != 4) {
+            const particle& anchor = cornerAnchors[i % 4];
+            reference.estimateState(dist(meshNodes[1], anchor), 0, anchor, cornerVars);
+        }
+    }
+    EXPECT_FALSE(handles[0].cancel());
+    EXPECT_EQ(async.getCompletedUpdates(), 7);
+    EXPECT_EQ(async.getEstimateAvg().x, reference.getEstimateAvg().x);
+
+    // dropping the whole queue leaves the estimate alone
+    std::vector<UpdateHandle> dropped;
+    async.withFilter([&](Filter&) {
+        for (int i = 0; i < 3; i++) {
+            dropped.push_back(async.estimateStateAsync(1.0f, 0, cornerAnchors[0], cornerVars));
+        }
+        EXPECT_EQ(async.cancelPending(), 3);
+    });
+    async.waitIdle();
+    for (const UpdateHandle& handle : dropped) {
+        EXPECT_EQ(handle.status(), UpdateStatus::Cancelled);
+        handle.wait();
+    }
+    EXPECT_EQ(async.getCompletedUpdates(), 7);
+    EXPECT_EQ(async.getEstimateAvg().x, reference.getEstimateAvg().x);
+
+    // destroying the filter cancels what is still queued
+    std::vector<UpdateHandle> orphans;
+    {
+        AsyncFilter shortLived(2000, false);
+        for (int i = 0; i < 20; i++) {
+            orphans.push_back(
+                shortLived.estimateStateAsync(dist(meshNodes[1], cornerAnchors[0]), 0, cornerAnchors[0], cornerVars));
+        }
+    }
+    for (const UpdateHandle& handle : orphans) {
+        EXPECT_TRUE(handle.done());
+    }
+}
+
 // Log memory usage for different N values
 // TEST(FilterPerformanceTest, MemoryUsage) {
 //     std::ofstream memLog("memory_usage.csv");
@@ -0,0 +1,133 @@
+#include "threadPool.h"
+#include <exception>
+
+static thread_local const ThreadPool* workerPool = nullptr;
+static thread_local int workerIndex = -1;
+
+ThreadPool::ThreadPool(int threads) {
+#if FILTER_THREADS
+    if (threads <= 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+#else
+    threads = 0;
+#endif
+    for (int i = 0; i < threads; i++) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+int ThreadPool::currentWorker() const {
+    return workerPool == this ? workerIndex : -1;
+}
+
+void ThreadPool::push(std::function<void()> task) {
+    int self = currentWorker();
+    int target = self >= 0 ? self : nextQueue++ % queues.size();
+    {
+        std::lock_guard<std::mutex> guard(queues[target]->lock);
+        queues[target]->tasks.push_back(std::move(task));
+    }
+    pending++;
+    // take the sleep lock so a worker between its check and its wait cannot miss this
+    { std::lock_guard<std::mutex> guard(sleepLock); }
+    wake.notify_one();
+}
+
+bool ThreadPool::tryRunOne(int self) {
+    std::function<void()> task;
+    if (self >= 0) {
+        std::lock_guard<std::mutex> guard(queues[self]->lock);
+        if (!queues[self]->tasks.empty()) {
+            task = std::move(queues[self]->tasks.back());
+            queues[self]->tasks.pop_back();
+        }
+    }
+    const int count = queues.size();
+    const int start = self >= 0 ? self + 1 : 0;
+    for (int k = 0; !task && k < count; k++) {
+        Queue& victim = *queues[(start + k) % count];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+        }
+    }
+    if (!task) {
+        return false;
+    }
+    pending--;
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop(int self) {
+    workerPool = this;
+    workerIndex = self;
+    while (true) {
+        if (tryRunOne(self)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(sleepLock);
+        wake.wait(guard, [this] { return stopping || pending > 0; });
+        if (stopping && pending == 0) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& fn) {
+    if (workers.empty() || count <= 1) {
+        for (int i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<int> remaining(count);
+    std::exception_ptr error;
+    std::mutex errorLock;
+    for (int i = 0; i < count; i++) {
+        push([&, i] {
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(errorLock);
+                if (!error) error = std::current_exception();
+            }
+            if (--remaining == 0) {
+                // under the sleep lock, so the caller cannot miss it between its check and its wait
+                { std::lock_guard<std::mutex> guard(sleepLock); }
+                wake.notify_all();
+            }
+        });
+    }
+
+    // help instead of blocking, this keeps nested calls from a worker live; with nothing left to take,
+    // sleep until the last task finishes or new work is pushed
+    const int self = currentWorker();
+    while (remaining > 0) {
+        if (tryRunOne(self)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(sleepLock);
+        wake.wait(guard, [&] { return remaining == 0 || pending > 0; });
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
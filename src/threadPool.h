@@ -0,0 +1,58 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Emscripten only has threads when built with -pthread
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define FILTER_THREADS 0
+#else
+#define FILTER_THREADS 1
+#endif
+
+// Work-stealing thread pool: every worker owns a deque, pops its own work from the back
+// and steals from the front of the others when it runs dry. Threads that wait on a
+// parallelFor help run queued tasks, so nested parallelFor calls cannot deadlock, and
+// sleep on the pool's condition variable once there is nothing left to take.
+class ThreadPool {
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::atomic<int> pending{0};
+    std::atomic<unsigned int> nextQueue{0};
+    bool stopping = false;
+
+    void push(std::function<void()> task);
+    bool tryRunOne(int self);
+    void workerLoop(int self);
+    int currentWorker() const;
+
+public:
+    // threads = 0 uses one worker per hardware thread; without thread support it has no workers
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return workers.size(); }
+
+    // Run fn(0) .. fn(count - 1) on the pool and return once all are done.
+    // The first exception thrown by fn is rethrown here.
+    void parallelFor(int count, const std::function<void(int)>& fn);
+};
+
+#endif // THREADPOOL_H
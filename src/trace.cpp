@@ -0,0 +1,121 @@
+#include "trace.h"
+#include "byteio.h"
+#include "filter.h"
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const unsigned char traceMagic[4] = {'P', 'F', 'T', 'R'};
+
+static void putParticle(unsigned char* out, particle p) {
+    putF32(out, p.x);
+    putF32(out + 4, p.y);
+    putF32(out + 8, p.z);
+    putF32(out + 12, p.d);
+}
+
+static particle getParticle(const unsigned char* in) {
+    return {getF32(in), getF32(in + 4), getF32(in + 8), getF32(in + 12)};
+}
+
+TraceWriter::TraceWriter(const std::string& path) : file(std::fopen(path.c_str(), "wb")) {
+    if (!file) {
+        throw std::runtime_error("Cannot open trace file " + path);
+    }
+    unsigned char header[traceHeaderSize];
+    std::memcpy(header, traceMagic, 4);
+    putU32(header + 4, traceVersion);
+    putU32(header + 8, traceRecordSize);
+    putU32(header + 12, 0);
+    std::fwrite(header, 1, traceHeaderSize, file);
+}
+
+TraceWriter::~TraceWriter() {
+    std::fclose(file);
+}
+
+void TraceWriter::record(uint32_t node, const float* measurements, float P_NLoss, const particle* anchorAvgs,
+                         const particle* anchorVars, int k) {
+    std::lock_guard<std::mutex> guard(lock);
+    unsigned char out[traceRecordSize];
+    for (int j = 0; j < k; j++) {
+        putU32(out, node);
+        putU32(out + 4, j == 0 ? k : 0);
+        putF32(out + 8, measurements[j]);
+        putF32(out + 12, P_NLoss);
+        putParticle(out + 16, anchorAvgs[j]);
+        putParticle(out + 32, anchorVars[j]);
+        if (std::fwrite(out, 1, traceRecordSize, file) != size_t(traceRecordSize)) {
+            throw std::runtime_error("Trace write failed");
+        }
+    }
+}
+
+void TraceWriter::flush() {
+    std::lock_guard<std::mutex> guard(lock);
+    std::fflush(file);
+}
+
+TraceReader::TraceReader(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open trace file " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < traceHeaderSize) {
+        close(fd);
+        throw std::runtime_error("Trace file " + path + " is too short");
+    }
+    length = info.st_size;
+    void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("Cannot map trace file " + path);
+    }
+    data = static_cast<const unsigned char*>(mapped);
+    if (std::memcmp(data, traceMagic, 4) != 0 || getU32(data + 4) != traceVersion ||
+        getU32(data + 8) != traceRecordSize) {
+        munmap(const_cast<unsigned char*>(data), length);
+        throw std::runtime_error(path + " is not a version 1 measurement trace");
+    }
+    // a partly written last record is ignored
+    count = (length - traceHeaderSize) / traceRecordSize;
+#ifdef MADV_SEQUENTIAL
+    madvise(const_cast<unsigned char*>(data), length, MADV_SEQUENTIAL);
+#endif
+}
+
+TraceReader::~TraceReader() {
+    munmap(const_cast<unsigned char*>(data), length);
+}
+
+TraceRecord TraceReader::operator[](size_t i) const {
+    const unsigned char* in = data + traceHeaderSize + i * traceRecordSize;
+    return {getU32(in), getU32(in + 4), getF32(in + 8), getF32(in + 12), getParticle(in + 16), getParticle(in + 32)};
+}
+
+size_t replayCall(const TraceReader& trace, size_t i, Filter& filter) {
+    TraceRecord first = trace[i];
+    if (first.batch == 0 || i + first.batch > trace.size()) {
+        throw std::runtime_error("Trace record " + std::to_string(i) + " does not start a complete call");
+    }
+    if (first.batch == 1) {
+        filter.estimateState(first.measurement, first.P_NLoss, first.anchorAvg, first.anchorVar);
+        return i + 1;
+    }
+    std::vector<float> measurements;
+    std::vector<particle> anchorAvgs;
+    std::vector<particle> anchorVars;
+    for (size_t j = i; j < i + first.batch; j++) {
+        TraceRecord r = trace[j];
+        measurements.push_back(r.measurement);
+        anchorAvgs.push_back(r.anchorAvg);
+        anchorVars.push_back(r.anchorVar);
+    }
+    filter.estimateStateBatch(measurements, anchorAvgs, anchorVars);
+    return i + first.batch;
+}
@@ -0,0 +1,75 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include "particles.h"
+
+class Filter;
+
+// Binary measurement trace: a 16-byte header followed by fixed 48-byte records, every field
+// little-endian whatever the host.
+//   header: "PFTR", uint32 version, uint32 record size, uint32 reserved (0)
+//   record: uint32 node, uint32 batch, float measurement, float P_NLoss,
+//           float anchorAvg x/y/z/d, float anchorVar x/y/z/d
+// batch is the measurement count of the estimateState / estimateStateBatch call on the first
+// record of the call and 0 on the records that continue it, which always follow it directly.
+const uint32_t traceVersion = 1;
+const int traceHeaderSize = 16;
+const int traceRecordSize = 48;
+
+struct TraceRecord {
+    uint32_t node;
+    uint32_t batch;
+    float measurement;
+    float P_NLoss;
+    particle anchorAvg;
+    particle anchorVar;
+};
+
+// Appends the updates of one or many filters to a trace file.
+// Filters share a writer through Filter::setTraceRecorder; a call is written under a lock,
+// so the filters of a FilterBank can record from their worker threads.
+class TraceWriter {
+private:
+    std::FILE* file;
+    std::mutex lock;
+
+public:
+    // Truncates path and writes the header, throws std::runtime_error if it cannot be opened
+    explicit TraceWriter(const std::string& path);
+    ~TraceWriter();
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    // One call of k measurements for node
+    void record(uint32_t node, const float* measurements, float P_NLoss, const particle* anchorAvgs,
+                const particle* anchorVars, int k);
+    void flush();
+};
+
+// Read-only memory map of a trace file, records are decoded on access
+class TraceReader {
+private:
+    const unsigned char* data = nullptr;
+    size_t length = 0;
+    size_t count = 0;
+
+public:
+    // Throws std::runtime_error if the file cannot be mapped or is not a version 1 trace
+    explicit TraceReader(const std::string& path);
+    ~TraceReader();
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    size_t size() const { return count; }
+    TraceRecord operator[](size_t i) const;
+};
+
+// Feed the call starting at record i to filter, returns the index of the next call
+size_t replayCall(const TraceReader& trace, size_t i, Filter& filter);
+
+#endif // TRACE_H